@@ -0,0 +1,65 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "ass_font_embedder.h"
+
+// Measures AssFontEmbedder::UUEncode() on random data, the way subfonts
+// are encoded before they are embedded.
+//
+//   uuencode_bench [MiB] [rounds]
+int main(int argc, char** argv) {
+  const size_t size = (argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16)
+                      << 20;
+  const int rounds = argc > 2 ? std::atoi(argv[2]) : 10;
+  if (size == 0 || rounds <= 0) {
+    std::fprintf(stderr, "usage: %s [MiB] [rounds]\n", argv[0]);
+    return 1;
+  }
+
+  std::string data(size, '\0');
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<int> dist(0, 255);
+  std::generate(data.begin(), data.end(),
+                [&]() { return static_cast<char>(dist(gen)); });
+
+  double best = 0.0;
+  size_t checksum = 0;
+  for (int round = 0; round < rounds; ++round) {
+    std::string out;
+    const auto start = std::chrono::steady_clock::now();
+    ass::AssFontEmbedder::UUEncode(data.data(), data.data() + data.size(),
+                                   true, out);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = std::max(best, (size >> 20) / elapsed.count());
+    checksum += out.size() + static_cast<unsigned char>(out[out.size() / 2]);
+  }
+
+  std::printf("UUEncode: %zu MiB x %d rounds, best %.1f MiB/s (%zu)\n",
+              size >> 20, rounds, best, checksum);
+  return 0;
+}
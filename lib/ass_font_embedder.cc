@@ -20,13 +20,17 @@
 #include "ass_font_embedder.h"
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <regex>
-#include <sstream>
 #include <unordered_set>
 
 #include <ghc/filesystem.hpp>
 
+#include "ass_mmap.h"
+
 namespace fs = ghc::filesystem;
 
 namespace ass {
@@ -35,24 +39,26 @@ void AssFontEmbedder::set_output_dir_path(const AString& output_dir_path) {
   output_dir_path_ = output_dir_path;
 }
 
+void AssFontEmbedder::set_font_blocks(
+    std::shared_ptr<const FontBlocks> font_blocks) {
+  font_blocks_ = font_blocks;
+}
+
+void AssFontEmbedder::set_write_renamed(const bool is_write_renamed) {
+  is_write_renamed_ = is_write_renamed;
+}
+
 bool AssFontEmbedder::Run(const bool is_subset_only, const bool is_embed_only,
                           const bool is_rename) {
-  fs::path input_path;
-  std::vector<std::string> text;
+  fs::path input_path(ap_.get_ass_path());
+  const bool is_renamed = !is_embed_only && is_rename;
 
-  if (!is_embed_only && is_rename) {
+  if (is_renamed) {
     AString path;
-    if (!WriteRenamed(path, text)) {
+    if (!WriteRenamed(path)) {
       return false;
     }
     input_path = fs::path(path);
-
-  } else {
-    input_path = fs::path(ap_.get_ass_path());
-    auto text_vec = ap_.get_text();
-    for (const auto& line : text_vec) {
-      text.emplace_back(line.text);
-    }
   }
 
   if (is_subset_only) {
@@ -62,7 +68,6 @@ bool AssFontEmbedder::Run(const bool is_subset_only, const bool is_embed_only,
   fs::path output_path(output_dir_path_ + fs::path::preferred_separator +
                        input_path.stem().native() + _ST(".assfonts") +
                        input_path.extension().native());
-  std::string buf_u8;
   std::ofstream output_ass(output_path.native());
 
   if (!output_ass.is_open()) {
@@ -70,25 +75,66 @@ bool AssFontEmbedder::Run(const bool is_subset_only, const bool is_embed_only,
     return false;
   }
 
-  size_t num_line = 0;
+  LineWriter writer(output_ass);
 
-  WriteOutput(text, num_line, output_ass);
+  if (!WriteOutput(is_renamed, writer)) {
+    return false;
+  }
+
+  if (!writer.Flush()) {
+    logger_->Error(_ST("Failed to write the file: {}"), output_path.native());
+    return false;
+  }
 
   logger_->Info(_ST("Create font-embeded subtitle: \"{}\""),
                 output_path.native());
   return true;
 }
 
-void AssFontEmbedder::WriteOutput(const std::vector<std::string>& text,
-                                  size_t& num_line, std::ofstream& output_ass) {
-  for (auto& line : text) {
-    ++num_line;
+// Streams the script from the parser, with fonts renamed and the rename info
+// put in front of the styles if is_rename is set. Lines are only copied when
+// they have something to rename.
+bool AssFontEmbedder::ForEachLine(
+    const bool is_rename,
+    const std::function<void(const nonstd::string_view line)>& callback) {
+  size_t rename_pos = 0;
+  bool has_font_info = false;
+  std::string renamed;
+
+  return ap_.ForEachLine(
+      [&](const unsigned int line_num, const nonstd::string_view line) {
+        if (!is_rename) {
+          callback(line);
+          return;
+        }
+
+        if (!has_font_info) {
+          nonstd::string_view tmp = Trim(line);
+          if (EqualsIgnoreCase(tmp, "[v4 styles]") ||
+              EqualsIgnoreCase(tmp, "[v4+ styles]")) {
+            for (const auto& info : font_info_) {
+              callback(info);
+            }
+            has_font_info = true;
+          }
+        }
+
+        if (FontRename(line_num, line, rename_pos, renamed)) {
+          callback(renamed);
+        } else {
+          callback(line);
+        }
+      });
+}
 
-    if (Trim(ToLower(line)) == "[events]") {
-      output_ass << "[Fonts]";
+bool AssFontEmbedder::WriteOutput(const bool is_rename, LineWriter& writer) {
+  return ForEachLine(is_rename, [&](const nonstd::string_view line) {
+    if (EqualsIgnoreCase(Trim(line), "[events]")) {
+      writer.Write("[Fonts]");
       bool has_none_ttf = false;
-      WriteFonts(has_none_ttf, output_ass);
-      output_ass << "\n\n" << line;
+      WriteFonts(has_none_ttf, writer);
+      writer.Append("\n");
+      writer.Write(line);
 
       if (has_none_ttf) {
         logger_->Warn(
@@ -98,17 +144,12 @@ void AssFontEmbedder::WriteOutput(const std::vector<std::string>& text,
                 "video players."));
       }
     } else {
-      output_ass << line;
-    }
-
-    if (num_line != text.size()) {
-      output_ass << '\n';
+      writer.Write(line);
     }
-  }
+  });
 }
 
-void AssFontEmbedder::WriteFonts(bool& has_none_ttf,
-                                 std::ofstream& output_ass) {
+void AssFontEmbedder::WriteFonts(bool& has_none_ttf, LineWriter& writer) {
   for (const auto& font : subfonts_info_) {
     fs::path font_path(font.subfont_path);
 
@@ -116,65 +157,102 @@ void AssFontEmbedder::WriteFonts(bool& has_none_ttf,
       logger_->Warn(_ST("\"{}\" is not a .ttf font."), font_path.native());
       has_none_ttf = true;
     }
+  }
+
+  if (font_blocks_) {
+    for (const auto& block : *font_blocks_) {
+      writer.Append(block);
+    }
+    return;
+  }
+
+  std::string buf;
+  for (const auto& font : subfonts_info_) {
+    buf.clear();
+    EncodeFont(font, *logger_, buf);
+    writer.Append(buf);
+  }
+}
 
-    AString a_fontname =
-        font_path.stem().native() + _ST("_0") + font_path.extension().native();
+// Encodes every subfont once, so that the result can be handed to the
+// embedders of several scripts sharing the same subfonts.
+std::shared_ptr<const AssFontEmbedder::FontBlocks>
+AssFontEmbedder::EncodeFonts(
+    const std::vector<FontSubsetter::FontSubsetInfo>& subfonts_info,
+    std::shared_ptr<Logger> logger) {
+  auto font_blocks = std::make_shared<FontBlocks>(subfonts_info.size());
+
+  for (size_t idx = 0; idx < subfonts_info.size(); ++idx) {
+    EncodeFont(subfonts_info[idx], *logger, (*font_blocks)[idx]);
+  }
+
+  return font_blocks;
+}
+
+void AssFontEmbedder::EncodeFont(const FontSubsetter::FontSubsetInfo& font,
+                                 Logger& logger, std::string& out) {
+  fs::path font_path(font.subfont_path);
+
+  AString a_fontname =
+      font_path.stem().native() + _ST("_0") + font_path.extension().native();
 
 #ifdef _WIN32
-    std::string fontname = WideToU8(a_fontname);
+  std::string fontname = WideToU8(a_fontname);
 #else
-    std::string fontname(a_fontname);
+  std::string fontname(a_fontname);
 #endif
 
-    std::ifstream is(font.subfont_path, std::ios::binary);
-    std::ostringstream ostrm;
-    ostrm << is.rdbuf();
-    std::string font_data(ostrm.str());
-    std::string uu_str =
-        UUEncode(font_data.c_str(), font_data.c_str() + font_data.size(), true);
-    output_ass << "\nfontname: " << fontname << '\n';
-    output_ass << uu_str;
-    ostrm.clear();
+  out += "\nfontname: " + fontname + '\n';
+
+  if (font.subfont_data) {
+    UUEncode(font.subfont_data->data(),
+             font.subfont_data->data() + font.subfont_data->size(), true, out);
+  } else {
+    MappedFile font_file;
+    if (!font_file.Open(font.subfont_path)) {
+      logger.Warn(_ST("Failed to read the file: {}"), font_path.native());
+    }
+    UUEncode(font_file.data(), font_file.data() + font_file.size(), true,
+             out);
   }
 }
 
-bool AssFontEmbedder::WriteRenamed(AString& path,
-                                   std::vector<std::string>& text) {
+bool AssFontEmbedder::WriteRenamed(AString& path) {
   fs::path input_path(ap_.get_ass_path());
   fs::path output_path(output_dir_path_ + fs::path::preferred_separator +
                        input_path.stem().native() + _ST(".rename") +
                        input_path.extension().native());
   path = output_path.native();
+
+  font_info_.clear();
+  WriteRenameInfo(font_info_);
+  set_rename_infos();
+
+  // Without the file, the renames only end up in the embedded subtitle
+  if (!is_write_renamed_) {
+    return true;
+  }
+
   std::ofstream output_ass(path);
   if (!output_ass.is_open()) {
     logger_->Error(_ST("\"{}\" cannot be created."), output_path.native());
     return false;
   }
 
-  std::vector<std::string> font_info;
-  WriteRenameInfo(font_info);
-  auto text_vec = ap_.get_text();
-  FontRename(text_vec);
-  for (const auto& line : text_vec) {
-    text.emplace_back(line.text);
-  }
+  LineWriter writer(output_ass);
+  bool is_written = ForEachLine(true, [&](const nonstd::string_view line) {
+    writer.Write(line);
+  });
 
-  for (auto iter = text.begin(); iter != text.end(); ++iter) {
-    std::string tmp = Trim(ToLower(*iter));
-    if (tmp == "[v4 styles]" || tmp == "[v4+ styles]") {
-      text.insert(iter, font_info.begin(), font_info.end());
-      break;
-    }
+  if (!is_written) {
+    return false;
   }
 
-  unsigned int counter = 0;
-  for (auto& line : text) {
-    if (counter != 0) {
-      output_ass << "\n";
-    }
-    output_ass << line;
-    ++counter;
+  if (!writer.Flush()) {
+    logger_->Error(_ST("Failed to write the file: {}"), output_path.native());
+    return false;
   }
+
   logger_->Info(_ST("Create font-renamed subtitle: \"{}\""),
                 output_path.native());
   return true;
@@ -182,10 +260,14 @@ bool AssFontEmbedder::WriteRenamed(AString& path,
 
 void AssFontEmbedder::Clear() {
   output_dir_path_.clear();
+  font_blocks_.reset();
 }
 
-std::string AssFontEmbedder::UUEncode(const char* begin, const char* end,
-                                      bool insert_linebreaks) {
+// Encodes three bytes at a time into four characters, looking up two at
+// once in a table indexed by 12 bits. Appends to out, breaking lines every
+// 80 characters.
+void AssFontEmbedder::UUEncode(const char* begin, const char* end,
+                               bool insert_linebreaks, std::string& out) {
   // Copyright (c) 2013, Thomas Goyne <plorkyeran@aegisub.org>
   //
   // Permission to use, copy, modify, and distribute this software for any
@@ -202,28 +284,54 @@ std::string AssFontEmbedder::UUEncode(const char* begin, const char* end,
   //
   // Aegisub Project http://www.aegisub.org/
 
+  static const std::array<std::array<char, 2>, 4096> UU_PAIRS = []() {
+    std::array<std::array<char, 2>, 4096> pairs;
+    for (size_t idx = 0; idx < pairs.size(); ++idx) {
+      pairs[idx] = {static_cast<char>((idx >> 6) + 33),
+                    static_cast<char>((idx & 0x3F) + 33)};
+    }
+    return pairs;
+  }();
+
+  const auto* src = reinterpret_cast<const unsigned char*>(begin);
   size_t size = std::distance(begin, end);
-  std::string ret;
-  ret.reserve((size * 4 + 2) / 3 + size / 80 * 2);
-  size_t written = 0;
-  for (size_t pos = 0; pos < size; pos += 3) {
-    unsigned char src[3] = {'\0', '\0', '\0'};
-    memcpy(src, begin + pos, std::min<size_t>(3u, size - pos));
-    unsigned char dst[4] = {static_cast<unsigned char>(src[0] >> 2),
-                            static_cast<unsigned char>(((src[0] & 0x3) << 4) |
-                                                       ((src[1] & 0xF0) >> 4)),
-                            static_cast<unsigned char>(((src[1] & 0xF) << 2) |
-                                                       ((src[2] & 0xC0) >> 6)),
-                            static_cast<unsigned char>(src[2] & 0x3F)};
-    for (size_t i = 0; i < std::min<size_t>(size - pos + 1, 4u); ++i) {
-      ret += dst[i] + 33;
-      if (insert_linebreaks && ++written == 80 && pos + 3 < size) {
-        written = 0;
-        ret += "\n";
-      }
+  size_t encoded_size = size / 3 * 4 + (size % 3 == 0 ? 0 : size % 3 + 1);
+  size_t num_breaks =
+      insert_linebreaks && encoded_size != 0 ? (encoded_size - 1) / 80 : 0;
+
+  size_t out_pos = out.size();
+  out.resize(out_pos + encoded_size + num_breaks);
+  char* dst = &out[out_pos];
+
+  // 20 groups of three bytes fill an 80 character line
+  const size_t groups_per_line = insert_linebreaks ? 20 : size / 3;
+  size_t pos = 0;
+
+  while (size - pos >= 3) {
+    size_t num_groups = std::min(groups_per_line, (size - pos) / 3);
+
+    for (size_t idx = 0; idx < num_groups; ++idx, pos += 3, dst += 4) {
+      uint32_t bits = static_cast<uint32_t>(src[pos]) << 16 |
+                      static_cast<uint32_t>(src[pos + 1]) << 8 | src[pos + 2];
+      std::memcpy(dst, UU_PAIRS[bits >> 12].data(), 2);
+      std::memcpy(dst + 2, UU_PAIRS[bits & 0xFFF].data(), 2);
+    }
+
+    if (insert_linebreaks && num_groups == groups_per_line && pos < size) {
+      *dst++ = '\n';
     }
   }
-  return ret;
+
+  if (pos < size) {
+    unsigned char tail[3] = {'\0', '\0', '\0'};
+    std::memcpy(tail, src + pos, size - pos);
+    uint32_t bits = static_cast<uint32_t>(tail[0]) << 16 |
+                    static_cast<uint32_t>(tail[1]) << 8 | tail[2];
+    char quad[4];
+    std::memcpy(quad, UU_PAIRS[bits >> 12].data(), 2);
+    std::memcpy(quad + 2, UU_PAIRS[bits & 0xFFF].data(), 2);
+    std::memcpy(dst, quad, size - pos + 1);
+  }
 }
 
 void AssFontEmbedder::WriteRenameInfo(std::vector<std::string>& text) {
@@ -246,42 +354,71 @@ void AssFontEmbedder::WriteRenameInfo(std::vector<std::string>& text) {
   text.emplace_back(std::string(""));
 }
 
-void AssFontEmbedder::FontRename(std::vector<AssParser::TextInfo>& text) {
-  auto rename_infos = ap_.get_rename_infos();
-  for (auto& rename_info : rename_infos) {
-    try {
-      rename_info.newname = fontname_map_.at(rename_info.fontname);
-    } catch (const std::out_of_range&) {
+// Keeps the renames that have a new name, ordered by line and by position
+// in the line, which is the order the lines are streamed and rebuilt in.
+void AssFontEmbedder::set_rename_infos() {
+  rename_infos_.clear();
+
+  for (auto& rename_info : ap_.get_rename_infos()) {
+    auto iter = fontname_map_.find(rename_info.fontname);
+    if (iter == fontname_map_.end() || iter->second.empty()) {
       continue;
     }
+    rename_info.newname = iter->second;
+    rename_infos_.emplace_back(std::move(rename_info));
   }
 
-  unsigned int line_num = 0;
-  int offset = 0;
-  for (const auto& rename_info : rename_infos) {
-    if (rename_info.newname.empty()) {
-      continue;
-    }
+  std::stable_sort(rename_infos_.begin(), rename_infos_.end(),
+                   [](const AssParser::RenameInfo& lhs,
+                      const AssParser::RenameInfo& rhs) {
+                     return lhs.line_num < rhs.line_num ||
+                            (lhs.line_num == rhs.line_num &&
+                             lhs.beg < rhs.beg);
+                   });
+}
 
-    if (line_num != rename_info.line_num) {
-      offset = 0;
-    }
+// Rebuilds line line_num with its renames applied, moving rename_pos past
+// them. Returns false, leaving renamed untouched, if the line has nothing
+// to rename.
+bool AssFontEmbedder::FontRename(const unsigned int line_num,
+                                 const nonstd::string_view line,
+                                 size_t& rename_pos,
+                                 std::string& renamed) const {
+  while (rename_pos < rename_infos_.size() &&
+         rename_infos_[rename_pos].line_num < line_num) {
+    ++rename_pos;
+  }
 
-    auto check_same_line = [=](const AssParser::TextInfo& text_info) {
-      return text_info.line_num == rename_info.line_num;
-    };
+  size_t last_pos = rename_pos;
+  size_t renamed_size = line.size();
+  for (; last_pos < rename_infos_.size() &&
+         rename_infos_[last_pos].line_num == line_num;
+       ++last_pos) {
+    const auto& rename_info = rename_infos_[last_pos];
+    renamed_size = renamed_size + rename_info.newname.size() -
+                   (rename_info.end - rename_info.beg);
+  }
+
+  if (last_pos == rename_pos) {
+    return false;
+  }
 
-    auto iter = std::find_if(text.begin(), text.end(), check_same_line);
-    if (iter == text.end()) {
+  renamed.clear();
+  renamed.reserve(renamed_size);
+  size_t copied = 0;
+
+  for (; rename_pos < last_pos; ++rename_pos) {
+    const auto& rename_info = rename_infos_[rename_pos];
+    if (rename_info.beg < copied || rename_info.end > line.size()) {
       continue;
     }
-    (*iter).text.replace(rename_info.beg + offset,
-                         (rename_info.end - rename_info.beg),
-                         rename_info.newname);
-
-    line_num = rename_info.line_num;
-    offset = offset + rename_info.newname.size() - rename_info.fontname.size();
+    renamed.append(line.data() + copied, rename_info.beg - copied);
+    renamed.append(rename_info.newname);
+    copied = rename_info.end;
   }
+  renamed.append(line.data() + copied, line.size() - copied);
+
+  return true;
 }
 
-}  // namespace ass
\ No newline at end of file
+}  // namespace ass
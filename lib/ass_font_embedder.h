@@ -21,21 +21,28 @@
 #define ASSFONTS_ASSFONTEMBEDDER_H_
 
 #include <fstream>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <nonstd/string_view.hpp>
+
 #include "ass_logger.h"
 #include "ass_parser.h"
 #include "ass_string.h"
 #include "font_subsetter.h"
+#include "line_writer.h"
 
 namespace ass {
 
 class AssFontEmbedder {
  public:
+  // Encoded "fontname:" sections, one per subfont
+  using FontBlocks = std::vector<std::string>;
+
   AssFontEmbedder(
       const AssParser& ap,
       const std::vector<FontSubsetter::FontSubsetInfo>& subfonts_info,
@@ -47,6 +54,15 @@ class AssFontEmbedder {
   AssFontEmbedder& operator=(const AssFontEmbedder&) = delete;
 
   void set_output_dir_path(const AString& output_ass_path);
+  void set_font_blocks(std::shared_ptr<const FontBlocks> font_blocks);
+  void set_write_renamed(const bool is_write_renamed);
+  static std::shared_ptr<const FontBlocks> EncodeFonts(
+      const std::vector<FontSubsetter::FontSubsetInfo>& subfonts_info,
+      std::shared_ptr<Logger> logger);
+  // Appends the ASS uuencoding of [begin, end) to out, optionally broken
+  // into lines of 80 characters
+  static void UUEncode(const char* begin, const char* end,
+                       bool insert_linebreaks, std::string& out);
   bool Run(const bool is_subset_only, const bool is_embed_only,
            const bool is_rename = false);
   void Clear();
@@ -57,17 +73,26 @@ class AssFontEmbedder {
   std::shared_ptr<Logger> logger_;
   AString output_dir_path_;
   std::map<std::string, std::string> fontname_map_;
+  std::vector<std::string> font_info_;
+  std::vector<AssParser::RenameInfo> rename_infos_;
+  std::shared_ptr<const FontBlocks> font_blocks_;
+  bool is_write_renamed_ = true;
+
+  bool ForEachLine(
+      const bool is_rename,
+      const std::function<void(const nonstd::string_view line)>& callback);
 
-  void WriteOutput(const std::vector<std::string>& text, size_t& num_line,
-                   std::ofstream& output_ass);
-  void WriteFonts(bool& has_none_ttf, std::ofstream& output_ass);
+  bool WriteOutput(const bool is_rename, LineWriter& writer);
+  void WriteFonts(bool& has_none_ttf, LineWriter& writer);
 
-  std::string UUEncode(const char* begin, const char* end,
-                       bool insert_linebreaks);
+  static void EncodeFont(const FontSubsetter::FontSubsetInfo& font,
+                         Logger& logger, std::string& out);
 
   void WriteRenameInfo(std::vector<std::string>& text);
-  void FontRename(std::vector<AssParser::TextInfo>& text);
-  bool WriteRenamed(AString& path, std::vector<std::string>& text);
+  void set_rename_infos();
+  bool FontRename(const unsigned int line_num, const nonstd::string_view line,
+                  size_t& rename_pos, std::string& renamed) const;
+  bool WriteRenamed(AString& path);
 };
 
 };  // namespace ass
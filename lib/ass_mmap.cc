@@ -0,0 +1,104 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include "ass_mmap.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ass {
+
+bool MappedFile::Open(const AString& file_path) {
+  Close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE fm = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (fm == NULL) {
+    return false;
+  }
+
+  void* base = MapViewOfFile(fm, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(fm);
+  if (base == NULL) {
+    return false;
+  }
+
+  data_ = static_cast<const char*>(base);
+  size_ = static_cast<size_t>(size.QuadPart);
+#else
+  int fd = open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat buffer;
+  if (fstat(fd, &buffer) || buffer.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+
+  void* base = mmap(nullptr, static_cast<size_t>(buffer.st_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+
+  data_ = static_cast<const char*>(base);
+  size_ = static_cast<size_t>(buffer.st_size);
+#endif
+
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ == nullptr) {
+    return;
+  }
+
+#ifdef _WIN32
+  UnmapViewOfFile(static_cast<LPCVOID>(data_));
+#else
+  munmap(const_cast<char*>(data_), size_);
+#endif
+
+  data_ = nullptr;
+  size_ = 0;
+}
+
+}  // namespace ass
@@ -0,0 +1,65 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_ASSMMAP_H_
+#define ASSFONTS_ASSMMAP_H_
+
+#include <cstddef>
+
+#include "ass_string.h"
+
+namespace ass {
+
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& prev) : data_(prev.data_), size_(prev.size_) {
+    prev.data_ = nullptr;
+    prev.size_ = 0;
+  }
+  MappedFile& operator=(MappedFile&& prev) {
+    Close();
+    data_ = prev.data_;
+    size_ = prev.size_;
+    prev.data_ = nullptr;
+    prev.size_ = 0;
+    return *this;
+  }
+
+  // Map the whole file read-only. Empty files cannot be mapped.
+  bool Open(const AString& file_path);
+  void Close();
+
+  inline bool is_open() const { return data_ != nullptr; }
+  inline const char* data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace ass
+
+#endif
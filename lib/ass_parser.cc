@@ -19,27 +19,58 @@
 
 #include "ass_parser.h"
 
+#include <algorithm>
+#include <cstring>
 #include <exception>
+#include <future>
 #include <sstream>
+#include <system_error>
 
 #include <asshdr/ass_recolorize.h>
 #include <compact_enc_det/compact_enc_det.h>
 #include <util/encodings/encodings.h>
 #include <ghc/filesystem.hpp>
 
+#include "line_reader.h"
+#include "line_writer.h"
+#include "wait_all.h"
+
 namespace fs = ghc::filesystem;
 
+// Scripts with at least this many dialogues are scanned in parallel, in
+// chunks of DIALOGUE_CHUNK_SIZE dialogues.
+constexpr size_t PARALLEL_MIN_DIALOGUES = 16384;
+constexpr size_t DIALOGUE_CHUNK_SIZE = 4096;
+
 namespace ass {
 
 void AssParser::set_output_dir_path(const AString& output_dir_path) {
   output_dir_path_ = output_dir_path;
 }
 
+void AssParser::set_logger(std::shared_ptr<Logger> logger) {
+  logger_ = logger;
+}
+
+void AssParser::SetThreadPool(ThreadPool* pool) {
+  pool_ = pool;
+}
+
+void AssParser::set_streaming_threshold(const uintmax_t size) {
+  streaming_threshold_ = size;
+}
+
+void AssParser::set_detect_sample_size(const size_t size) {
+  detect_sample_size_ = size;
+}
+
+void AssParser::set_write_cleaned(const bool is_write_cleaned) {
+  is_write_cleaned_ = is_write_cleaned;
+}
+
 bool AssParser::ReadFile(const AString& ass_file_path) {
   fs::path ass_path(ass_file_path);
   std::ifstream ass_file(ass_file_path, std::ios::binary);
-  std::string buf_u8;
-  unsigned int line_num = 0;
 
   if (!ass_file.is_open()) {
     logger_->Error(_ST("\"{}\" cannot be opened."), ass_path.native());
@@ -48,70 +79,246 @@ bool AssParser::ReadFile(const AString& ass_file_path) {
 
   logger_->Info(_ST("Reading input file: \"{}\""), ass_path.native());
 
-  if (!GetUTF8(ass_file, buf_u8)) {
+  ass_path_ = ass_file_path;
+  std::error_code ec;
+  uintmax_t file_size = fs::file_size(ass_path, ec);
+  bool is_streamed = false;
+
+  if (!ec && file_size >= streaming_threshold_) {
+    bool is_utf8 = true;
+    is_streamed = ReadStream(ass_file, is_utf8);
+    if (!is_streamed && is_utf8) {
+      return false;
+    }
+  }
+
+  if (!is_streamed) {
+    ass_file.clear();
+    ass_file.seekg(0);
+    if (!ReadContent(ass_file)) {
+      return false;
+    }
+  }
+
+  if (font_sets_.empty()) {
+    logger_->Error(_ST("Failed to parse \"{}\". Format error."),
+                   ass_path.native());
     return false;
   }
 
-  ass_path_ = ass_file_path;
-  std::istringstream isstream(buf_u8);
-  std::string line;
+  if (!CleanFonts()) {
+    return false;
+  }
+
+  return true;
+}
+
+bool AssParser::ReadContent(std::ifstream& is) {
+  if (!GetUTF8(is, content_)) {
+    return false;
+  }
 
-  while (SafeGetLine(isstream, line)) {
+  size_t pos = 0;
+  nonstd::string_view line;
+  unsigned int line_num = 0;
+  bool in_fonts = false;
+
+  while (NextLine(pos, line)) {
     ++line_num;
-    std::string trimmed_line = Trim(ToLower(line));
 
-    if (trimmed_line == "[fonts]") {
+    if (!KeepLine(line, in_fonts)) {
       has_fonts_ = true;
-      SkipFontsLines(isstream, line_num);
-    } else {
-      TextInfo text_info = {line_num, line};
-      text_.emplace_back(text_info);
+      continue;
     }
+
+    TextInfo text_info = {line_num,
+                          static_cast<size_t>(line.data() - content_.data()),
+                          line.size()};
+    text_.emplace_back(text_info);
   }
 
   if (!ParseAss()) {
     return false;
   }
 
-  set_stylename_fontdesc();
-
   set_font_sets();
 
-  if (font_sets_.empty()) {
-    logger_->Error(_ST("Failed to parse \"{}\". Format error."),
-                   ass_path.native());
-    return false;
+  return true;
+}
+
+// Parses a UTF-8 script line by line without keeping its text. Dialogues are
+// scanned as they are read; if a style turns up after the first dialogue,
+// they are scanned again in a second pass once all styles are known. Sets
+// is_utf8 to false, with nothing parsed, if the file is not UTF-8.
+bool AssParser::ReadStream(std::istream& is, bool& is_utf8) {
+  LineReader reader(is);
+  nonstd::string_view line;
+  unsigned int line_num = 0;
+  bool in_fonts = false;
+  bool has_dialogue = false;
+  bool need_rescan = false;
+  ParseState state;
+  StyleInfo style;
+  DialogueInfo dialogue;
+  std::vector<DialogueScan> scans(1);
+
+  while (reader.Next(line)) {
+    ++line_num;
+
+    if (!IsPlainU8(line.data(), line.size())) {
+      is_utf8 = false;
+      stylename_fontdesc_.clear();
+      rename_infos_.clear();
+      has_default_style_ = false;
+      has_fonts_ = false;
+      return false;
+    }
+
+    if (!KeepLine(line, in_fonts)) {
+      has_fonts_ = true;
+      continue;
+    }
+
+    switch (ClassifyLine(line, state)) {
+      case LineType::STYLE:
+        style = {line_num, line.data(), {}};
+        if (!ParseLine(line, 10, style.style)) {
+          return false;
+        }
+        AddStyle(style);
+        need_rescan = need_rescan || has_dialogue;
+        break;
+      case LineType::DIALOGUE:
+        dialogue.line_num = line_num;
+        dialogue.line_beg = line.data();
+        dialogue.dialogue.clear();
+        if (!ParseLine(line, 10, dialogue.dialogue)) {
+          return false;
+        }
+        if (!need_rescan) {
+          ScanDialogue(dialogue, scans[0]);
+        }
+        has_dialogue = true;
+        break;
+      default:
+        break;
+    }
   }
 
-  if (!CleanFonts()) {
+  logger_->Info("Detect input file encoding:  \"{}\"", "UTF-8");
+  is_streaming_ = true;
+
+  if (!CheckTitles(state)) {
     return false;
   }
 
+  if (need_rescan) {
+    scans[0] = DialogueScan();
+    state = ParseState();
+    bool is_read = ForEachLine([&](const unsigned int line_num,
+                                   const nonstd::string_view line) {
+      if (ClassifyLine(line, state) != LineType::DIALOGUE) {
+        return;
+      }
+      DialogueInfo dialogue = {line_num, line.data(), {}};
+      ParseLine(line, 10, dialogue.dialogue);
+      ScanDialogue(dialogue, scans[0]);
+    });
+
+    if (!is_read) {
+      return false;
+    }
+  }
+
+  MergeScans(scans);
+
   return true;
 }
 
-void AssParser::SkipFontsLines(std::istringstream& is, unsigned int line_num) {
-  std::string line;
+// Drops embedded [Fonts] sections: the title and every line after it up to
+// the next section we know of, whose title is kept.
+bool AssParser::KeepLine(const nonstd::string_view line, bool& in_fonts) {
+  nonstd::string_view tmp = Trim(line);
 
-  while (SafeGetLine(is, line)) {
-    ++line_num;
-    std::string tmp = Trim(ToLower(line));
+  if (!in_fonts) {
+    in_fonts = EqualsIgnoreCase(tmp, "[fonts]");
+    return !in_fonts;
+  }
 
-    if (tmp == "[events]" || tmp == "[script info]" || tmp == "[v4 styles]" ||
-        tmp == "[v4+ styles]" || tmp == "[graphics]") {
-      TextInfo text_info = {line_num, line};
-      text_.emplace_back(text_info);
-      break;
-    }
+  if (EqualsIgnoreCase(tmp, "[events]") ||
+      EqualsIgnoreCase(tmp, "[script info]") ||
+      EqualsIgnoreCase(tmp, "[v4 styles]") ||
+      EqualsIgnoreCase(tmp, "[v4+ styles]") ||
+      EqualsIgnoreCase(tmp, "[graphics]")) {
+    in_fonts = false;
+  }
+
+  return !in_fonts;
+}
+
+// Splits content_ the way SafeGetLine() splits a stream: "\n", "\r\n" and
+// "\r" end a line, and the document always ends with an empty line.
+bool AssParser::NextLine(size_t& pos, nonstd::string_view& line) const {
+  if (pos == std::string::npos) {
+    return false;
   }
+
+  size_t end = content_.find_first_of("\r\n", pos);
+
+  if (end == std::string::npos) {
+    line = nonstd::string_view(content_.data() + pos, content_.size() - pos);
+    pos = line.empty() ? std::string::npos : content_.size();
+    return true;
+  }
+
+  line = nonstd::string_view(content_.data() + pos, end - pos);
+  pos = end + 1;
+  if (content_[end] == '\r' && pos < content_.size() && content_[pos] == '\n') {
+    ++pos;
+  }
+
+  return true;
 }
 
 bool AssParser::get_has_fonts() const {
   return has_fonts_;
 }
 
-std::vector<AssParser::TextInfo> AssParser::get_text() const {
-  return text_;
+bool AssParser::ForEachLine(
+    const std::function<void(const unsigned int line_num,
+                             const nonstd::string_view line)>& callback) const {
+  if (!is_streaming_) {
+    for (const auto& text_info : text_) {
+      callback(text_info.line_num, GetLine(text_info));
+    }
+    return true;
+  }
+
+  std::ifstream is(ass_path_, std::ios::binary);
+  if (!is.is_open()) {
+    logger_->Error(_ST("\"{}\" cannot be opened."),
+                   fs::path(ass_path_).native());
+    return false;
+  }
+
+  LineReader reader(is);
+  nonstd::string_view line;
+  unsigned int line_num = 0;
+  bool in_fonts = false;
+
+  while (reader.Next(line)) {
+    ++line_num;
+    if (KeepLine(line, in_fonts)) {
+      callback(line_num, line);
+    }
+  }
+
+  return true;
+}
+
+nonstd::string_view AssParser::GetLine(const TextInfo& text_info) const {
+  return nonstd::string_view(content_.data() + text_info.offset,
+                             text_info.length);
 }
 
 AString AssParser::get_ass_path() const {
@@ -122,8 +329,8 @@ std::vector<AssParser::RenameInfo> AssParser::get_rename_infos() const {
   return rename_infos_;
 }
 
-std::map<AssParser::FontDesc, std::unordered_set<char32_t>>
-AssParser::get_font_sets() const {
+std::map<AssParser::FontDesc, CodepointSet> AssParser::get_font_sets()
+    const {
   return font_sets_;
 }
 
@@ -169,40 +376,50 @@ bool AssParser::Recolorize(const AString& ass_file_path,
 void AssParser::Clear() {
   ass_path_.clear();
   output_dir_path_.clear();
+  content_.clear();
   text_.clear();
-  styles_.clear();
   has_default_style_ = false;
   has_fonts_ = false;
+  is_streaming_ = false;
   dialogues_.clear();
   font_sets_.clear();
   stylename_fontdesc_.clear();
 }
 
 bool AssParser::GetUTF8(const std::ifstream& is, std::string& res) {
-  std::stringstream sstream;
-  sstream << is.rdbuf();
-  bool is_reliable = false;
-  int bytes_consumed;
+  std::string buf;
+  std::streambuf* sb = is.rdbuf();
+  std::streamoff size = sb->pubseekoff(0, std::ios::end, std::ios::in);
 
-  Encoding encoding = CompactEncDet::DetectEncoding(
-      sstream.str().c_str(), static_cast<int>(sstream.str().size()), nullptr,
-      nullptr, nullptr, UNKNOWN_ENCODING, UNKNOWN_LANGUAGE,
-      CompactEncDet::QUERY_CORPUS, false, &bytes_consumed, &is_reliable);
+  if (size > 0 && sb->pubseekpos(0, std::ios::in) == 0) {
+    buf.resize(static_cast<size_t>(size));
+    buf.resize(static_cast<size_t>(sb->sgetn(&buf[0], size)));
+  } else {
+    std::ostringstream ostrm;
+    ostrm << sb;
+    buf = ostrm.str();
+  }
 
-  std::string encode_name = MimeEncodingName(encoding);
+  std::string encode_name = DetectEncoding(buf, detect_sample_size_);
+  bool is_converted = encode_name != "UTF-8" &&
+                      IconvConvert(buf, res, encode_name, "UTF-8");
 
-  if (encode_name == "GB2312") {
-    encode_name = "GB18030";
+  // The sample may have missed the bytes that set the encoding apart
+  if (encode_name != "UTF-8" && !is_converted &&
+      buf.size() > detect_sample_size_) {
+    encode_name = DetectEncoding(buf, buf.size());
+    is_converted = encode_name != "UTF-8" &&
+                   IconvConvert(buf, res, encode_name, "UTF-8");
   }
 
   logger_->Info("Detect input file encoding:  \"{}\"", encode_name);
 
   if (encode_name == "UTF-8") {
-    res = sstream.str();
+    res.swap(buf);
     return true;
   }
 
-  if (!IconvConvert(sstream.str(), res, encode_name, "UTF-8")) {
+  if (!is_converted) {
     logger_->Error("Recode to \"UTF-8\" failed.");
     return false;
   }
@@ -210,15 +427,71 @@ bool AssParser::GetUTF8(const std::ifstream& is, std::string& res) {
   return true;
 }
 
-bool AssParser::FindTitle(const std::string& line, const std::string& title) {
-  if (ToLower(line).substr(0, title.size()) == ToLower(title)) {
-    return true;
-  } else {
-    return false;
+// A byte order mark settles the encoding, and text that is plain UTF-8 is
+// taken as is. Only the rest goes to CED, which looks at sample_size bytes
+// starting from the first line with a non-ASCII byte.
+std::string AssParser::DetectEncoding(const std::string& buf,
+                                      size_t sample_size) const {
+  static const std::pair<std::string, std::string> BOMS[] = {
+      {std::string("\xFF\xFE\x00\x00", 4), "UTF-32LE"},
+      {std::string("\x00\x00\xFE\xFF", 4), "UTF-32BE"},
+      {"\xFF\xFE", "UTF-16LE"},
+      {"\xFE\xFF", "UTF-16BE"}};
+
+  for (const auto& bom : BOMS) {
+    if (buf.compare(0, bom.first.size(), bom.first) == 0) {
+      return bom.second;
+    }
+  }
+
+  if (IsPlainU8(buf.data(), buf.size())) {
+    return "UTF-8";
+  }
+
+  size_t begin = 0;
+
+  if (sample_size < buf.size()) {
+    auto high = std::find_if(buf.begin(), buf.end(), [](const char ch) {
+      return static_cast<unsigned char>(ch) >= 0x80;
+    });
+    if (high != buf.end()) {
+      begin = buf.rfind('\n', high - buf.begin());
+      begin = begin == std::string::npos ? 0 : begin + 1;
+    }
   }
+  sample_size = std::min(sample_size, buf.size() - begin);
+
+  bool is_reliable = false;
+  int bytes_consumed;
+
+  Encoding encoding = CompactEncDet::DetectEncoding(
+      buf.data() + begin, static_cast<int>(sample_size), nullptr, nullptr,
+      nullptr, UNKNOWN_ENCODING, UNKNOWN_LANGUAGE, CompactEncDet::QUERY_CORPUS,
+      false, &bytes_consumed, &is_reliable);
+
+  std::string encode_name = MimeEncodingName(encoding);
+
+  if (encode_name == "GB2312") {
+    encode_name = "GB18030";
+  }
+
+  return encode_name;
+}
+
+// Text that can be taken as UTF-8 without asking CED: well-formed, and free
+// of the NUL and ESC bytes that UTF-16 and ISO-2022 text would contain.
+bool AssParser::IsPlainU8(const char* data, size_t size) {
+  return std::memchr(data, '\0', size) == nullptr &&
+         std::memchr(data, 0x1B, size) == nullptr && IsValidU8(data, size);
 }
 
-bool AssParser::ParseLine(const std::string& line, const unsigned int num_field,
+bool AssParser::FindTitle(const nonstd::string_view line,
+                          const nonstd::string_view title) const {
+  return EqualsIgnoreCase(line.substr(0, title.size()), title);
+}
+
+bool AssParser::ParseLine(const nonstd::string_view line,
+                          const unsigned int num_field,
                           std::vector<nonstd::string_view>& res) {
   nonstd::string_view word;
   auto ch = line.begin();
@@ -270,31 +543,81 @@ bool AssParser::ParseLine(const std::string& line, const unsigned int num_field,
 }
 
 bool AssParser::ParseAss() {
-  bool has_style = false;
-  bool has_event = false;
-  auto line = text_.begin();
+  ParseState state;
 
-  while (line != text_.end()) {
-    if (!GetStyles(line, text_.end(), has_style)) {
-      return false;
-    }
+  for (const auto& text_info : text_) {
+    nonstd::string_view line = GetLine(text_info);
 
-    if (!GetEvents(line, text_.end(), has_event)) {
-      return false;
+    switch (ClassifyLine(line, state)) {
+      case LineType::STYLE: {
+        StyleInfo style = {text_info.line_num, line.data(), {}};
+        if (!ParseLine(line, 10, style.style)) {
+          return false;
+        }
+        AddStyle(style);
+        break;
+      }
+      case LineType::DIALOGUE: {
+        DialogueInfo dialogue = {text_info.line_num, line.data(), {}};
+        if (!ParseLine(line, 10, dialogue.dialogue)) {
+          return false;
+        }
+        dialogues_.emplace_back(std::move(dialogue));
+        break;
+      }
+      default:
+        break;
     }
+  }
 
-    if (line != text_.end()) {
-      ++line;
-    }
+  return CheckTitles(state);
+}
+
+// Tracks which section a line belongs to. A "[" line ends the styles and
+// events sections; after styles it may open the events, otherwise it is
+// not looked at again.
+AssParser::LineType AssParser::ClassifyLine(const nonstd::string_view line,
+                                            ParseState& state) const {
+  switch (state.section) {
+    case Section::STYLES:
+      if (FindTitle(line, "[")) {
+        state.section = Section::NONE;
+        if (FindTitle(line, "[Events]")) {
+          state.section = Section::EVENTS;
+          state.has_event = true;
+        }
+        return LineType::OTHER;
+      }
+      return FindTitle(line, "Style:") ? LineType::STYLE : LineType::OTHER;
+
+    case Section::EVENTS:
+      if (FindTitle(line, "[")) {
+        state.section = Section::NONE;
+        return LineType::OTHER;
+      }
+      return FindTitle(line, "Dialogue:") ? LineType::DIALOGUE
+                                          : LineType::OTHER;
+
+    default:
+      if (FindTitle(line, "[V4+ Styles]") || FindTitle(line, "[V4 Styles]")) {
+        state.section = Section::STYLES;
+        state.has_style = true;
+      } else if (FindTitle(line, "[Events]")) {
+        state.section = Section::EVENTS;
+        state.has_event = true;
+      }
+      return LineType::OTHER;
   }
+}
 
-  if (!has_style) {
+bool AssParser::CheckTitles(const ParseState& state) {
+  if (!state.has_style) {
     logger_->Error(_ST("Failed to parse \"{}\". No Style Title found."),
                    ass_path_);
     return false;
   }
 
-  if (!has_event) {
+  if (!state.has_event) {
     logger_->Error(_ST("Failed to parse \"{}\". No Event Title found."),
                    ass_path_);
     return false;
@@ -303,101 +626,36 @@ bool AssParser::ParseAss() {
   return true;
 }
 
-bool AssParser::GetStyles(std::vector<TextInfo>::iterator& line,
-                          const std::vector<TextInfo>::iterator end,
-                          bool& has_style) {
-  if (!FindTitle((*line).text, "[V4+ Styles]") &&
-      !FindTitle((*line).text, "[V4 Styles]")) {
-    return true;
-  }
-
-  ++line;
-
-  for (; line != text_.end(); ++line) {
-    if (FindTitle((*line).text, "[")) {
-      break;
-    }
-
-    if (!FindTitle((*line).text, "Style:")) {
-      continue;
-    }
+void AssParser::AddStyle(const StyleInfo& style) {
+  FontDesc empty_font_desc;
 
-    std::vector<nonstd::string_view> styles;
-    if (!ParseLine((*line).text, 10, styles)) {
-      return false;
-    }
-    StyleInfo res = {(*line).line_num, (*line).text.c_str(), styles};
-    styles_.emplace_back(res);
+  if (style.style[1] == "Default") {
+    has_default_style_ = true;
   }
-  has_style = true;
 
-  return true;
-}
+  stylename_fontdesc_[std::string(style.style[1])] = empty_font_desc;
+  nonstd::string_view fontname = style.style[2];
 
-bool AssParser::GetEvents(std::vector<TextInfo>::iterator& line,
-                          const std::vector<TextInfo>::iterator end,
-                          bool& has_event) {
-  if (!FindTitle((*line).text, "[Events]")) {
-    return true;
+  if (fontname[0] == '@') {
+    fontname = fontname.substr(1);
   }
 
-  ++line;
-
-  for (; line != text_.end(); ++line) {
-    if (FindTitle((*line).text, "[")) {
-      break;
-    }
-
-    if (!FindTitle((*line).text, "Dialogue:")) {
-      continue;
-    }
+  stylename_fontdesc_[std::string(style.style[1])].fontname =
+      std::string(fontname);
+  stylename_fontdesc_[std::string(style.style[1])].bold =
+      CalculateBold(StringToInt(std::string(style.style[8])));
+  stylename_fontdesc_[std::string(style.style[1])].italic =
+      CalculateItalic(StringToInt(std::string(style.style[9])));
 
-    std::vector<nonstd::string_view> res;
-    if (!ParseLine((*line).text, 10, res)) {
-      return false;
-    }
-
-    DialogueInfo dialogue_info = {(*line).line_num, (*line).text.c_str(), res};
-    dialogues_.emplace_back(dialogue_info);
-  }
-
-  has_event = true;
-
-  return true;
-}
-
-void AssParser::set_stylename_fontdesc() {
-  FontDesc empty_font_desc;
-
-  for (const auto& style : styles_) {
-    if (style.style[1] == "Default") {
-      has_default_style_ = true;
-    }
-
-    stylename_fontdesc_[std::string(style.style[1])] = empty_font_desc;
-    nonstd::string_view fontname = style.style[2];
-
-    if (fontname[0] == '@') {
-      fontname = fontname.substr(1);
-    }
-
-    stylename_fontdesc_[std::string(style.style[1])].fontname =
-        std::string(fontname);
-    stylename_fontdesc_[std::string(style.style[1])].bold =
-        CalculateBold(StringToInt(std::string(style.style[8])));
-    stylename_fontdesc_[std::string(style.style[1])].italic =
-        CalculateItalic(StringToInt(std::string(style.style[9])));
-
-    RenameInfo rename_info = {
-        style.line_num,
-        static_cast<size_t>(&(*fontname.begin()) - style.line_beg),
-        static_cast<size_t>(&(*fontname.end()) - style.line_beg),
-        std::string(fontname), ""};
-    rename_infos_.emplace_back(rename_info);
-  }
+  RenameInfo rename_info = {
+      style.line_num,
+      static_cast<size_t>(&(*fontname.begin()) - style.line_beg),
+      static_cast<size_t>(&(*fontname.end()) - style.line_beg),
+      std::string(fontname), ""};
+  rename_infos_.emplace_back(rename_info);
 }
 
-int AssParser::CalculateBold(int value) {
+int AssParser::CalculateBold(int value) const {
   if (value == 1 || value == -1) {
     return 700;
   } else if (value <= 0) {
@@ -406,7 +664,7 @@ int AssParser::CalculateBold(int value) {
   return value;
 }
 
-int AssParser::CalculateItalic(int value) {
+int AssParser::CalculateItalic(int value) const {
   if (value == 1 || value == -1) {
     return 100;
   } else if (value <= 0) {
@@ -416,31 +674,56 @@ int AssParser::CalculateItalic(int value) {
 }
 
 void AssParser::set_font_sets() {
-  const std::unordered_set<char32_t> empty_set;
+  size_t num_chunks = 1;
+  if (pool_ != nullptr && dialogues_.size() >= PARALLEL_MIN_DIALOGUES) {
+    num_chunks = (dialogues_.size() + DIALOGUE_CHUNK_SIZE - 1) /
+                 DIALOGUE_CHUNK_SIZE;
+  }
 
-  for (const auto& dialogue : dialogues_) {
-    FontDesc font_desc_style = GetFontDescStyle(dialogue);
-    FontDesc font_desc;
+  std::vector<DialogueScan> scans(num_chunks);
 
-    if (font_sets_.find(font_desc_style) == font_sets_.end()) {
-      font_sets_[font_desc_style] = empty_set;
+  if (num_chunks == 1) {
+    ScanDialogues(0, dialogues_.size(), scans[0]);
+  } else {
+    std::vector<std::future<void>> results;
+    for (size_t idx = 0; idx < num_chunks; ++idx) {
+      results.emplace_back(pool_->enqueue([this, &scans, idx]() {
+        ScanDialogues(idx * DIALOGUE_CHUNK_SIZE,
+                      std::min(dialogues_.size(),
+                               (idx + 1) * DIALOGUE_CHUNK_SIZE),
+                      scans[idx]);
+      }));
     }
+    WaitAll(results);
+  }
 
-    auto wch = Iterator(dialogue.dialogue[10]);
-    font_desc = font_desc_style;
-
-    const auto end = Iterator(dialogue.dialogue[10], true);
+  MergeScans(scans);
+}
 
-    while (wch != end) {
-      GetCharacter(wch, end, font_desc_style, font_desc, dialogue.line_num,
-                   dialogue.line_beg);
+void AssParser::MergeScans(std::vector<DialogueScan>& scans) {
+  // Chunks hold consecutive dialogues, so merging them in order gives the
+  // same rename infos and warnings as a serial scan.
+  for (auto& scan : scans) {
+    for (auto& font_set : scan.font_sets) {
+      auto iter = font_sets_.find(font_set.first);
+      if (iter == font_sets_.end()) {
+        font_sets_.emplace(font_set.first, std::move(font_set.second));
+      } else {
+        iter->second.Union(font_set.second);
+      }
+    }
+    rename_infos_.insert(rename_infos_.end(), scan.rename_infos.begin(),
+                         scan.rename_infos.end());
+    for (const auto& missing_style : scan.missing_styles) {
+      logger_->Warn("Style \"{}\" not found. (Line {})", missing_style.first,
+                    missing_style.second);
     }
   }
 
   std::vector<FontDesc> keys_for_del;
 
   for (const auto& font_set : font_sets_) {
-    if (font_set.second.size() == 0) {
+    if (font_set.second.empty()) {
       keys_for_del.emplace_back(font_set.first);
     }
   }
@@ -450,31 +733,65 @@ void AssParser::set_font_sets() {
   }
 }
 
-AssParser::FontDesc AssParser::GetFontDescStyle(const DialogueInfo& dialogue) {
+void AssParser::ScanDialogues(const size_t begin, const size_t end,
+                              DialogueScan& scan) const {
+  for (size_t idx = begin; idx < end; ++idx) {
+    ScanDialogue(dialogues_[idx], scan);
+  }
+}
+
+void AssParser::ScanDialogue(const DialogueInfo& dialogue,
+                             DialogueScan& scan) const {
+  FontDesc font_desc_style = GetFontDescStyle(dialogue, scan);
+  FontDesc font_desc;
+
+  if (scan.font_sets.find(font_desc_style) == scan.font_sets.end()) {
+    scan.font_sets[font_desc_style] = CodepointSet();
+  }
+
+  // Set of the current font_desc, looked up lazily after each override
+  CodepointSet* font_set = nullptr;
+
+  auto wch = Iterator(dialogue.dialogue[10]);
+  font_desc = font_desc_style;
+
+  const auto end_wch = Iterator(dialogue.dialogue[10], true);
+
+  while (wch != end_wch) {
+    GetCharacter(dialogue.dialogue[10], wch, end_wch, font_desc_style,
+                 font_desc, font_set, dialogue.line_num, dialogue.line_beg,
+                 scan);
+  }
+}
+
+AssParser::FontDesc AssParser::GetFontDescStyle(const DialogueInfo& dialogue,
+                                                DialogueScan& scan) const {
   FontDesc font_desc_style;
 
-  if (stylename_fontdesc_.find(std::string(dialogue.dialogue[4])) ==
-      stylename_fontdesc_.end()) {
+  auto style = stylename_fontdesc_.find(std::string(dialogue.dialogue[4]));
+  if (style == stylename_fontdesc_.end()) {
 
     if (has_default_style_) {
-      font_desc_style = stylename_fontdesc_["Default"];
+      font_desc_style = stylename_fontdesc_.at("Default");
     } else {
-      logger_->Warn("Style \"{}\" not found. (Line {})",
-                    std::string(dialogue.dialogue[4]), dialogue.line_num);
+      scan.missing_styles.emplace_back(std::string(dialogue.dialogue[4]),
+                                       dialogue.line_num);
       font_desc_style.fontname = "";
     }
 
   } else {
-    font_desc_style = stylename_fontdesc_[std::string(dialogue.dialogue[4])];
+    font_desc_style = style->second;
   }
 
   return font_desc_style;
 }
 
-void AssParser::GetCharacter(Iterator& wch, const Iterator end,
+void AssParser::GetCharacter(const nonstd::string_view& text, Iterator& wch,
+                             const Iterator end,
                              const FontDesc& font_desc_style,
-                             FontDesc& font_desc, const unsigned int line_num,
-                             const char* line_beg) {
+                             FontDesc& font_desc, CodepointSet*& font_set,
+                             const unsigned int line_num, const char* line_beg,
+                             DialogueScan& scan) const {
   if (*wch == U'\\' && (wch + 1) != end &&
       (*(wch + 1) == U'h' || *(wch + 1) == U'n' || *(wch + 1) == U'N')) {
     wch += 2;
@@ -482,237 +799,140 @@ void AssParser::GetCharacter(Iterator& wch, const Iterator end,
   }
 
   if (*wch == U'{') {
-    nonstd::string_view override(&(*wch.ToStdIter()),
-                                 end.ToStdIter() - wch.ToStdIter());
-    auto pos = U8Find(override, U"}", 0);
+    size_t beg = wch.ToStdIter() - text.begin();
+    size_t close = text.find('}', beg);
 
-    if (pos == Iterator::NPOS) {
+    if (close == nonstd::string_view::npos) {
       if (!font_desc_style.fontname.empty()) {
-        font_sets_[font_desc].insert(*wch);
+        if (font_set == nullptr) {
+          font_set = &scan.font_sets[font_desc];
+        }
+        font_set->Insert(*wch);
       }
       ++wch;
       return;
 
     } else {
-      override = nonstd::string_view(
-          &(*((wch + 1).ToStdIter())),
-          (Iterator(override) += pos).ToStdIter() - (wch + 1).ToStdIter());
-
-      StyleOverride(override, font_desc, font_desc_style, line_num, line_beg);
-      wch += (pos + 1);
+      StyleOverride(text.substr(beg + 1, close - beg - 1), font_desc,
+                    font_desc_style, line_num, line_beg, scan);
+      font_set = nullptr;
+      wch = Iterator(text, close + 1);
       return;
     }
   }
 
   if (wch != end) {
     if (!font_desc_style.fontname.empty()) {
-      font_sets_[font_desc].insert(*wch);
+      if (font_set == nullptr) {
+        font_set = &scan.font_sets[font_desc];
+      }
+      font_set->Insert(*wch);
     }
     ++wch;
   }
 }
 
+// Splits the override block at each backslash and applies the tags we care
+// about in the order they appear, so a \r resets whatever came before it and
+// tags after it win.
 void AssParser::StyleOverride(const nonstd::string_view code,
                               FontDesc& font_desc,
                               const FontDesc& font_desc_style,
                               const unsigned int line_num,
-                              const char* line_beg) {
-  auto font_pos =
-      ChangeFontname(code, font_desc, font_desc_style, line_num, line_beg);
-  auto bold_pos = ChangeBold(code, font_desc, font_desc_style);
-  auto italic_pos = ChangeItalic(code, font_desc, font_desc_style);
-  ChangeStyle(code, font_desc, font_desc_style, line_num, font_pos, bold_pos,
-              italic_pos);
-}
-
-AssParser::Iterator::difference_type AssParser::ChangeFontname(
-    const nonstd::string_view code, FontDesc& font_desc,
-    const FontDesc& font_desc_style, const unsigned int line_num,
-    const char* line_beg) {
-  Iterator::difference_type pos = 0;
-  Iterator::difference_type last_pos = 0;
-
-  while (true) {
-    last_pos = pos;
-    pos = U8Find(code, U"\\fn", pos);
-
-    if (pos == Iterator::NPOS) {
-      break;
-    }
-
-    pos += 3;
-    auto iter = Iterator(code) + pos;
-    auto view_beg = iter.ToStdIter();
-
-    while (iter != code.end() && *iter != U'\\') {
-      ++iter;
-      ++pos;
-    }
+                              const char* line_beg, DialogueScan& scan) const {
+  auto is_value = [](const nonstd::string_view tag) {
+    return tag.size() > 1 &&
+           ((tag[1] >= '0' && tag[1] <= '9') || tag[1] == '-' || tag[1] == ' ');
+  };
 
-    nonstd::string_view font_view(&(*view_beg), iter.ToStdIter() - view_beg);
-    font_view = Trim(font_view);
+  size_t pos = code.find('\\');
 
-    if (font_view.empty()) {
-      font_desc.fontname = font_desc_style.fontname;
-      continue;
-    }
+  while (pos != nonstd::string_view::npos) {
+    size_t next = code.find('\\', pos + 1);
+    nonstd::string_view tag =
+        code.substr(pos + 1, next == nonstd::string_view::npos
+                                 ? nonstd::string_view::npos
+                                 : next - pos - 1);
+    pos = next;
 
-    if (font_view[0] == '@') {
-      font_view = font_view.substr(1);
+    if (tag.substr(0, 2) == "fn") {
+      ChangeFontname(tag.substr(2), font_desc, font_desc_style, line_num,
+                     line_beg, scan);
+    } else if (!tag.empty() && tag[0] == 'b' && is_value(tag)) {
+      ChangeBold(tag.substr(1), font_desc, font_desc_style);
+    } else if (!tag.empty() && tag[0] == 'i' && is_value(tag)) {
+      ChangeItalic(tag.substr(1), font_desc, font_desc_style);
+    } else if (!tag.empty() && tag[0] == 'r' && tag.substr(1, 2) != "nd") {
+      ChangeStyle(tag.substr(1), font_desc, font_desc_style, line_num, scan);
     }
-    font_desc.fontname = std::string(font_view);
-
-    RenameInfo rename_info = {
-        line_num, static_cast<size_t>(&(*font_view.begin()) - line_beg),
-        static_cast<size_t>(&(*font_view.end()) - line_beg),
-        std::string(font_view), ""};
-    rename_infos_.emplace_back(rename_info);
   }
-
-  return last_pos;
 }
 
-AssParser::Iterator::difference_type AssParser::ChangeBold(
-    const nonstd::string_view code, FontDesc& font_desc,
-    const FontDesc& font_desc_style) {
-  Iterator::difference_type pos = 0;
-  Iterator::difference_type last_pos = 0;
-
-  while (true) {
-    last_pos = pos;
-    pos = U8Find(code, U"\\b", pos);
-
-    if (pos == Iterator::NPOS) {
-      break;
-    }
-
-    pos += 2;
-    auto iter = Iterator(code) + pos;
+void AssParser::ChangeFontname(const nonstd::string_view value,
+                               FontDesc& font_desc,
+                               const FontDesc& font_desc_style,
+                               const unsigned int line_num,
+                               const char* line_beg, DialogueScan& scan) const {
+  nonstd::string_view font_view = Trim(value);
 
-    if (iter == code.end() ||
-        !((*iter >= U'0' && *iter <= U'9') || *iter == U'-' || *iter == U' ')) {
-      continue;
-    }
-
-    std::u32string bold;
-
-    while (iter != code.end() && *iter != U'\\') {
-      bold.push_back(*iter);
-      ++iter;
-      ++pos;
-    }
-
-    std::string bold_u8 = U32ToU8(bold);
+  if (font_view.empty()) {
+    font_desc.fontname = font_desc_style.fontname;
+    return;
+  }
 
-    if (!Trim(bold_u8).empty()) {
-      font_desc.bold = CalculateBold(StringToInt(Trim(bold_u8)));
-    } else {
-      font_desc.bold = font_desc_style.bold;
-    }
+  if (font_view[0] == '@') {
+    font_view = font_view.substr(1);
   }
+  font_desc.fontname = std::string(font_view);
 
-  return last_pos;
+  RenameInfo rename_info = {
+      line_num, static_cast<size_t>(&(*font_view.begin()) - line_beg),
+      static_cast<size_t>(&(*font_view.end()) - line_beg),
+      std::string(font_view), ""};
+  scan.rename_infos.emplace_back(rename_info);
 }
 
-AssParser::Iterator::difference_type AssParser::ChangeItalic(
-    const nonstd::string_view code, FontDesc& font_desc,
-    const FontDesc& font_desc_style) {
-  Iterator::difference_type pos = 0;
-  Iterator::difference_type last_pos = 0;
-
-  while (true) {
-    last_pos = pos;
-    pos = U8Find(code, U"\\i", pos);
-
-    if (pos == Iterator::NPOS) {
-      break;
-    }
-
-    pos += 2;
-    auto iter = Iterator(code) + pos;
-
-    if (iter == code.end() ||
-        !((*iter >= U'0' && *iter <= U'9') || *iter == U'-' || *iter == U' ')) {
-      continue;
-    }
-
-    std::u32string italic;
+void AssParser::ChangeBold(const nonstd::string_view value, FontDesc& font_desc,
+                           const FontDesc& font_desc_style) const {
+  nonstd::string_view bold = Trim(value);
 
-    while (iter != code.end() && *iter != U'\\') {
-      italic.push_back(*iter);
-      ++iter;
-      ++pos;
-    }
+  if (!bold.empty()) {
+    font_desc.bold = CalculateBold(StringToInt(std::string(bold)));
+  } else {
+    font_desc.bold = font_desc_style.bold;
+  }
+}
 
-    std::string italic_u8 = U32ToU8(italic);
+void AssParser::ChangeItalic(const nonstd::string_view value,
+                             FontDesc& font_desc,
+                             const FontDesc& font_desc_style) const {
+  nonstd::string_view italic = Trim(value);
 
-    if (!Trim(italic_u8).empty()) {
-      font_desc.italic = CalculateItalic(StringToInt(Trim(italic_u8)));
-    } else {
-      font_desc.italic = font_desc_style.italic;
-    }
+  if (!italic.empty()) {
+    font_desc.italic = CalculateItalic(StringToInt(std::string(italic)));
+  } else {
+    font_desc.italic = font_desc_style.italic;
   }
-
-  return last_pos;
 }
 
-void AssParser::ChangeStyle(const nonstd::string_view code, FontDesc& font_desc,
+void AssParser::ChangeStyle(const nonstd::string_view value,
+                            FontDesc& font_desc,
                             const FontDesc& font_desc_style,
                             const unsigned int line_num,
-                            Iterator::difference_type font_pos,
-                            Iterator::difference_type bold_pos,
-                            Iterator::difference_type italic_pos) {
-  Iterator::difference_type pos = 0;
-  Iterator::difference_type last_pos = 0;
-  FontDesc update_desc = font_desc;
-
-  while (true) {
-    last_pos = pos;
-    pos = U8Find(code, U"\\r", pos);
-
-    if (pos == Iterator::NPOS) {
-      break;
-    }
-
-    pos += 2;
-    auto iter = Iterator(code) + pos;
-
-    if (code.end() - iter.ToStdIter() >= 2 &&
-        std::string(iter.ToStdIter(), iter.ToStdIter() + 2) == "nd") {
-      continue;
-    }
-
-    std::u32string style;
-
-    while (iter != code.end() && *iter != U'\\') {
-      style.push_back(*iter);
-      ++iter;
-      ++pos;
-    }
-
-    std::string style_name = Trim(U32ToU8(style));
-
-    if (style_name.empty()) {
-      update_desc = font_desc_style;
-      continue;
-    }
+                            DialogueScan& scan) const {
+  std::string style_name(Trim(value));
 
-    if (stylename_fontdesc_.find(style_name) == stylename_fontdesc_.end()) {
-      logger_->Warn("Style \"{}\" not found. (Line {})", style_name, line_num);
-      update_desc = font_desc_style;
-    } else {
-      update_desc = stylename_fontdesc_[style_name];
-    }
+  if (style_name.empty()) {
+    font_desc = font_desc_style;
+    return;
   }
 
-  if (last_pos > font_pos) {
-    font_desc.fontname = update_desc.fontname;
-  }
-  if (last_pos > bold_pos) {
-    font_desc.bold = update_desc.bold;
-  }
-  if (last_pos > italic_pos) {
-    font_desc.italic = update_desc.italic;
+  auto style = stylename_fontdesc_.find(style_name);
+  if (style == stylename_fontdesc_.end()) {
+    scan.missing_styles.emplace_back(style_name, line_num);
+    font_desc = font_desc_style;
+  } else {
+    font_desc = style->second;
   }
 }
 
@@ -722,6 +942,13 @@ bool AssParser::CleanFonts() {
   }
 
   fs::path input_path(ass_path_);
+
+  if (!is_write_cleaned_) {
+    logger_->Info(_ST("Found fonts in \"{}\". Delete them."),
+                  input_path.native());
+    return true;
+  }
+
   fs::path output_path = fs::path(output_dir_path_) /
                          (input_path.stem().native() + _ST(".cleaned") +
                           input_path.extension().native());
@@ -735,18 +962,19 @@ bool AssParser::CleanFonts() {
     logger_->Error(_ST("Failed to write the file: {}"), output_path.native());
     return false;
   }
-  size_t num_line = 0;
+  LineWriter writer(os);
 
-  for (const auto& line : text_) {
-    ++num_line;
-    os << line.text;
+  bool is_read =
+      ForEachLine([&](const unsigned int, const nonstd::string_view line) {
+        writer.Write(line);
+      });
 
-    if (num_line != text_.size()) {
-      os << '\n';
-    }
+  if (!writer.Flush()) {
+    logger_->Error(_ST("Failed to write the file: {}"), output_path.native());
+    return false;
   }
 
-  return true;
+  return is_read;
 }
 
 }  // namespace ass
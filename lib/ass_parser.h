@@ -20,18 +20,22 @@
 #ifndef ASSFONTS_ASSPARSER_H_
 #define ASSFONTS_ASSPARSER_H_
 
+#include <cstdint>
 #include <fstream>
+#include <functional>
+#include <istream>
 #include <map>
 #include <memory>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
 #include <nonstd/string_view.hpp>
 
+#include "ThreadPool.h"
 #include "ass_logger.h"
 #include "ass_string.h"
 #include "ass_utf8.h"
+#include "codepoint_set.h"
 
 namespace ass {
 
@@ -49,11 +53,6 @@ class AssParser {
   //AssParser(const AssParser&) = delete;
   AssParser& operator=(const AssParser&) = delete;
 
-  struct TextInfo {
-    unsigned int line_num;
-    std::string text;
-  };
-
   struct RenameInfo {
     unsigned int line_num;
     size_t beg;
@@ -85,17 +84,40 @@ class AssParser {
 
   void set_output_dir_path(const AString& output_dir_path);
 
+  // Logger used from now on, e.g. when the script is read again later on
+  // behalf of another task
+  void set_logger(std::shared_ptr<Logger> logger);
+
+  // Pool used to scan the dialogues of very large scripts in parallel
+  void SetThreadPool(ThreadPool* pool);
+
+  // UTF-8 scripts of at least this many bytes are parsed straight from the
+  // file instead of being loaded into memory
+  void set_streaming_threshold(const uintmax_t size);
+
+  // Number of leading bytes CED looks at when the script is neither marked
+  // by a BOM nor plain UTF-8
+  void set_detect_sample_size(const size_t size);
+
+  // Whether a script that already embeds fonts is saved again without them
+  // as a ".cleaned" copy
+  void set_write_cleaned(const bool is_write_cleaned);
+
   bool ReadFile(const AString& ass_file_path);
 
   bool get_has_fonts() const;
 
-  std::vector<TextInfo> get_text() const;
+  // Calls callback for every line of the script except embedded [Fonts]
+  // sections. Streamed scripts are read from the input file again.
+  bool ForEachLine(const std::function<void(const unsigned int line_num,
+                                            const nonstd::string_view line)>&
+                       callback) const;
 
   AString get_ass_path() const;
 
   std::vector<RenameInfo> get_rename_infos() const;
 
-  std::map<FontDesc, std::unordered_set<char32_t>> get_font_sets() const;
+  std::map<FontDesc, CodepointSet> get_font_sets() const;
 
   bool Recolorize(const AString& ass_file_path, const unsigned int brightness);
 
@@ -104,6 +126,13 @@ class AssParser {
  private:
   using Iterator = U8Iterator<nonstd::string_view>;
 
+  // A line of the decoded document, stored as a range of content_
+  struct TextInfo {
+    unsigned int line_num;
+    size_t offset;
+    size_t length;
+  };
+
   struct StyleInfo {
     unsigned int line_num;
     const char* line_beg;
@@ -121,62 +150,98 @@ class AssParser {
   AString ass_path_;
   AString output_dir_path_;
 
+  std::string content_;
   std::vector<TextInfo> text_;
-  std::vector<StyleInfo> styles_;
   std::vector<DialogueInfo> dialogues_;
 
   bool has_default_style_ = false;
   bool has_fonts_ = false;
+  bool is_streaming_ = false;
+  uintmax_t streaming_threshold_ = uintmax_t(64) << 20;
+  size_t detect_sample_size_ = 64 << 10;
+  bool is_write_cleaned_ = true;
 
-  std::map<FontDesc, std::unordered_set<char32_t>> font_sets_;
+  std::map<FontDesc, CodepointSet> font_sets_;
   std::map<std::string, FontDesc> stylename_fontdesc_;
 
   std::vector<RenameInfo> rename_infos_;
 
-  void SkipFontsLines(std::istringstream& is, unsigned int line_num);
+  ThreadPool* pool_ = nullptr;
+
+  // What scanning a run of dialogues produces. Warnings about missing
+  // styles are kept as (name, line_num) and logged after merging.
+  struct DialogueScan {
+    std::map<FontDesc, CodepointSet> font_sets;
+    std::vector<RenameInfo> rename_infos;
+    std::vector<std::pair<std::string, unsigned int>> missing_styles;
+  };
+
+  enum class Section { NONE, STYLES, EVENTS };
+
+  enum class LineType { OTHER, STYLE, DIALOGUE };
+
+  struct ParseState {
+    Section section = Section::NONE;
+    bool has_style = false;
+    bool has_event = false;
+  };
+
+  static bool KeepLine(const nonstd::string_view line, bool& in_fonts);
+
+  bool ReadContent(std::ifstream& is);
+  bool ReadStream(std::istream& is, bool& is_utf8);
+
+  bool NextLine(size_t& pos, nonstd::string_view& line) const;
+  nonstd::string_view GetLine(const TextInfo& text_info) const;
 
   bool GetUTF8(const std::ifstream& is, std::string& res);
+  std::string DetectEncoding(const std::string& buf,
+                             size_t sample_size) const;
+  static bool IsPlainU8(const char* data, size_t size);
 
-  bool FindTitle(const std::string& line, const std::string& title);
+  bool FindTitle(const nonstd::string_view line,
+                 const nonstd::string_view title) const;
 
-  bool ParseLine(const std::string& line, const unsigned int num_field,
+  bool ParseLine(const nonstd::string_view line, const unsigned int num_field,
                  std::vector<nonstd::string_view>& res);
 
   bool ParseAss();
-  bool GetStyles(std::vector<TextInfo>::iterator& line,
-                 const std::vector<TextInfo>::iterator end, bool& has_style);
-  bool GetEvents(std::vector<TextInfo>::iterator& line,
-                 const std::vector<TextInfo>::iterator end, bool& has_event);
+  LineType ClassifyLine(const nonstd::string_view line,
+                        ParseState& state) const;
+  bool CheckTitles(const ParseState& state);
 
-  void set_stylename_fontdesc();
-  int CalculateBold(int value);
-  int CalculateItalic(int value);
+  void AddStyle(const StyleInfo& style);
+  int CalculateBold(int value) const;
+  int CalculateItalic(int value) const;
 
   void set_font_sets();
-  FontDesc GetFontDescStyle(const DialogueInfo& dialogue);
-  void GetCharacter(Iterator& wch, const Iterator end,
-                    const FontDesc& font_desc_style, FontDesc& font_desc,
-                    const unsigned int line_num, const char* line_beg);
+  void MergeScans(std::vector<DialogueScan>& scans);
+  void ScanDialogues(const size_t begin, const size_t end,
+                     DialogueScan& scan) const;
+  void ScanDialogue(const DialogueInfo& dialogue, DialogueScan& scan) const;
+  FontDesc GetFontDescStyle(const DialogueInfo& dialogue,
+                            DialogueScan& scan) const;
+  void GetCharacter(const nonstd::string_view& text, Iterator& wch,
+                    const Iterator end, const FontDesc& font_desc_style,
+                    FontDesc& font_desc, CodepointSet*& font_set,
+                    const unsigned int line_num, const char* line_beg,
+                    DialogueScan& scan) const;
 
   void StyleOverride(const nonstd::string_view code, FontDesc& font_desc,
                      const FontDesc& font_desc_style,
-                     const unsigned int line_num, const char* line_beg);
-  Iterator::difference_type ChangeFontname(const nonstd::string_view code,
-                                           FontDesc& font_desc,
-                                           const FontDesc& font_desc_style,
-                                           const unsigned int line_num,
-                                           const char* line_beg);
-  Iterator::difference_type ChangeBold(const nonstd::string_view code,
-                                       FontDesc& font_desc,
-                                       const FontDesc& font_desc_style);
-  Iterator::difference_type ChangeItalic(const nonstd::string_view code,
-                                         FontDesc& font_desc,
-                                         const FontDesc& font_desc_style);
-  void ChangeStyle(const nonstd::string_view code, FontDesc& font_desc,
-                   const FontDesc& font_desc_style, const unsigned int line_num,
-                   Iterator::difference_type font_pos,
-                   Iterator::difference_type bold_pos,
-                   Iterator::difference_type italic_pos);
+                     const unsigned int line_num, const char* line_beg,
+                     DialogueScan& scan) const;
+  void ChangeFontname(const nonstd::string_view value, FontDesc& font_desc,
+                      const FontDesc& font_desc_style,
+                      const unsigned int line_num, const char* line_beg,
+                      DialogueScan& scan) const;
+  void ChangeBold(const nonstd::string_view value, FontDesc& font_desc,
+                  const FontDesc& font_desc_style) const;
+  void ChangeItalic(const nonstd::string_view value, FontDesc& font_desc,
+                    const FontDesc& font_desc_style) const;
+  void ChangeStyle(const nonstd::string_view value, FontDesc& font_desc,
+                   const FontDesc& font_desc_style,
+                   const unsigned int line_num, DialogueScan& scan) const;
 
   bool CleanFonts();
 
@@ -21,10 +21,14 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdint>
 #include <cstdlib>
 #include <cwctype>
 #include <exception>
+#include <map>
 #include <memory>
+#include <system_error>
+#include <utility>
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -79,6 +83,25 @@ std::wstring ToLower(const std::wstring& str) {
   return res;
 }
 
+bool EqualsIgnoreCase(const nonstd::string_view lhs,
+                      const nonstd::string_view rhs) {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+
+  auto lower = [](char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+  };
+
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    if (lower(lhs[i]) != lower(rhs[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 AString ToAString(const long i) {
 #ifdef _WIN32
   return std::to_wstring(i);
@@ -118,82 +141,99 @@ std::istream& SafeGetLine(std::istream& is, std::string& t) {
 
 bool IconvConvert(const std::string& in, std::string& out,
                   const std::string& from_code, const std::string& to_code) {
-  iconv_wrapper::iconv cvt;
+  // iconv_open() is expensive (it may load gconv modules from disk), so each
+  // thread keeps its converters open. A null entry remembers that the pair is
+  // not supported by this iconv build.
+  thread_local std::map<std::pair<std::string, std::string>,
+                        std::unique_ptr<iconv_wrapper::iconv>>
+      converters;
+
+  auto key = std::make_pair(from_code, to_code);
+  auto it = converters.find(key);
+  if (it == converters.end()) {
+    std::unique_ptr<iconv_wrapper::iconv> cvt(new iconv_wrapper::iconv);
+    try {
+      cvt->open(from_code, to_code);
+    } catch (std::system_error&) {
+      cvt.reset();
+    }
+    it = converters.emplace(std::move(key), std::move(cvt)).first;
+  }
 
-  try {
-    cvt.open(from_code, to_code);
-  } catch (std::system_error&) {
+  if (!it->second) {
     return false;
   }
 
+  // A previous failed conversion may have left shift state behind
+  it->second->reset();
+
+  std::string res(in.size(), '\0');
   try {
-    out = cvt.convert(in);
+    it->second->convert(in, nullptr, &res);
   } catch (std::system_error&) {
     return false;
   }
+  out.swap(res);
 
   return true;
 }
 
-std::u32string U8ToU32(const std::string& str_u8) {
-  std::u32string str_u32;
-  std::string str_u32_narrow;
-
-  IconvConvert(str_u8, str_u32_narrow, "UTF-8", "UTF-32BE");
-
-  str_u32.resize(str_u32_narrow.size() / 4);
-
-  for (size_t i = 0; i < str_u32.size(); ++i) {
-    if (endian::native == endian::big) {
-      str_u32[i] =
-          (static_cast<unsigned char>(str_u32_narrow[i * 4]) << 0) |
-          (static_cast<unsigned char>(str_u32_narrow[i * 4 + 1]) << 8) |
-          (static_cast<unsigned char>(str_u32_narrow[i * 4 + 2]) << 16) |
-          (static_cast<unsigned char>(str_u32_narrow[i * 4 + 3]) << 24);
+bool U16BEToU8(const std::string& in, std::string& out) {
+  out.clear();
+  if (in.size() % 2 != 0) {
+    return false;
+  }
+  out.reserve(in.size() + in.size() / 2);
+
+  const auto* p = reinterpret_cast<const unsigned char*>(in.data());
+  const auto* end = p + in.size();
+  while (p != end) {
+    uint32_t ch = (static_cast<uint32_t>(p[0]) << 8) | p[1];
+    p += 2;
+    if (ch >= 0xDC00 && ch <= 0xDFFF) {
+      return false;
+    }
+    if (ch >= 0xD800 && ch <= 0xDBFF) {
+      if (p == end) {
+        return false;
+      }
+      uint32_t low = (static_cast<uint32_t>(p[0]) << 8) | p[1];
+      if (low < 0xDC00 || low > 0xDFFF) {
+        return false;
+      }
+      p += 2;
+      ch = 0x10000 + ((ch - 0xD800) << 10) + (low - 0xDC00);
+    }
 
+    if (ch < 0x80) {
+      out.push_back(static_cast<char>(ch));
+    } else if (ch < 0x800) {
+      out.push_back(static_cast<char>(0xC0 | (ch >> 6)));
+      out.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+    } else if (ch < 0x10000) {
+      out.push_back(static_cast<char>(0xE0 | (ch >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
     } else {
-      str_u32[i] =
-          (static_cast<unsigned char>(str_u32_narrow[i * 4 + 3]) << 0) |
-          (static_cast<unsigned char>(str_u32_narrow[i * 4 + 2]) << 8) |
-          (static_cast<unsigned char>(str_u32_narrow[i * 4 + 1]) << 16) |
-          (static_cast<unsigned char>(str_u32_narrow[i * 4 + 0]) << 24);
+      out.push_back(static_cast<char>(0xF0 | (ch >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((ch >> 12) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
     }
   }
 
+  return true;
+}
+
+std::u32string U8ToU32(const std::string& str_u8) {
+  std::u32string str_u32;
+  DecodeU8(str_u8.data(), str_u8.size(), str_u32);
   return str_u32;
 }
 
 std::string U32ToU8(const std::u32string& str_u32) {
   std::string str_u8;
-  std::string str_u32_narrow;
-
-  str_u32_narrow.resize(str_u32.size() * 4);
-
-  for (size_t i = 0; i < str_u32.size(); ++i) {
-    if (endian::native == endian::big) {
-      str_u32_narrow[i * 4] =
-          static_cast<char>(static_cast<uint32_t>(str_u32[i]) >> 0);
-      str_u32_narrow[i * 4 + 1] =
-          static_cast<char>(static_cast<uint32_t>(str_u32[i]) >> 8);
-      str_u32_narrow[i * 4 + 2] =
-          static_cast<char>(static_cast<uint32_t>(str_u32[i]) >> 16);
-      str_u32_narrow[i * 4 + 3] =
-          static_cast<char>(static_cast<uint32_t>(str_u32[i]) >> 24);
-
-    } else {
-      str_u32_narrow[i * 4 + 3] =
-          static_cast<char>(static_cast<uint32_t>(str_u32[i]) >> 0);
-      str_u32_narrow[i * 4 + 2] =
-          static_cast<char>(static_cast<uint32_t>(str_u32[i]) >> 8);
-      str_u32_narrow[i * 4 + 1] =
-          static_cast<char>(static_cast<uint32_t>(str_u32[i]) >> 16);
-      str_u32_narrow[i * 4] =
-          static_cast<char>(static_cast<uint32_t>(str_u32[i]) >> 24);
-    }
-  }
-
-  IconvConvert(str_u32_narrow, str_u8, "UTF-32BE", "UTF-8");
-
+  EncodeU8(str_u32.data(), str_u32.size(), str_u8);
   return str_u8;
 }
 
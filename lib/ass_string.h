@@ -59,6 +59,10 @@ nonstd::string_view Trim(const nonstd::string_view sv);
 std::string ToLower(const std::string& str);
 std::wstring ToLower(const std::wstring& str);
 
+// ASCII case-insensitive comparison, without allocating lowered copies
+bool EqualsIgnoreCase(const nonstd::string_view lhs,
+                      const nonstd::string_view rhs);
+
 AString ToAString(const long i);
 
 std::istream& SafeGetLine(std::istream& is, std::string& t);
@@ -66,6 +70,10 @@ std::istream& SafeGetLine(std::istream& is, std::string& t);
 bool IconvConvert(const std::string& in, std::string& out,
                   const std::string& from_code, const std::string& to_code);
 
+// Native UTF-16BE to UTF-8 conversion. Fails on odd length or unpaired
+// surrogates, like iconv does.
+bool U16BEToU8(const std::string& in, std::string& out);
+
 std::u32string U8ToU32(const std::string& str_u8);
 std::string U32ToU8(const std::u32string& str_u32);
 
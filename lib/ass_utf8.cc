@@ -19,6 +19,7 @@
 
 #include "ass_utf8.h"
 
+#include <cstdint>
 #include <cstring>
 
 namespace ass {
@@ -696,4 +697,146 @@ unsigned char* StrToLwrExt(unsigned char* pString) {
   return pString;
 }
 
+namespace {
+
+// Number of leading bytes that are plain ASCII, tested eight at a time
+size_t AsciiPrefix(const unsigned char* p, size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, p + i, 8);
+    if (word & 0x8080808080808080ULL) {
+      break;
+    }
+  }
+  while (i < size && p[i] < 0x80) {
+    ++i;
+  }
+  return i;
+}
+
+// Decodes the multi-byte sequence at p. Returns its length, or 0 if it is
+// truncated, overlong, a surrogate or above U+10FFFF.
+size_t DecodeSequence(const unsigned char* p, size_t size, char32_t& ch) {
+  unsigned char c = p[0];
+  size_t len;
+  char32_t min;
+  if ((c & 0xE0) == 0xC0) {
+    len = 2;
+    min = 0x80;
+    ch = c & 0x1F;
+  } else if ((c & 0xF0) == 0xE0) {
+    len = 3;
+    min = 0x800;
+    ch = c & 0x0F;
+  } else if ((c & 0xF8) == 0xF0) {
+    len = 4;
+    min = 0x10000;
+    ch = c & 0x07;
+  } else {
+    return 0;
+  }
+
+  if (size < len) {
+    return 0;
+  }
+  for (size_t j = 1; j < len; ++j) {
+    if ((p[j] & 0xC0) != 0x80) {
+      return 0;
+    }
+    ch = (ch << 6) | (p[j] & 0x3F);
+  }
+  if (ch < min || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF)) {
+    return 0;
+  }
+  return len;
+}
+
+}  // namespace
+
+bool IsValidU8(const char* data, size_t size) {
+  const auto* p = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+
+  while (i < size) {
+    i += AsciiPrefix(p + i, size - i);
+    if (i == size) {
+      break;
+    }
+
+    char32_t ch;
+    size_t len = DecodeSequence(p + i, size - i, ch);
+    if (len == 0) {
+      return false;
+    }
+    i += len;
+  }
+
+  return true;
+}
+
+bool DecodeU8(const char* data, size_t size, std::u32string& out) {
+  out.clear();
+  out.reserve(size);
+
+  const auto* p = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+
+  while (i < size) {
+    size_t ascii = AsciiPrefix(p + i, size - i);
+    for (size_t j = 0; j < ascii; ++j) {
+      out.push_back(static_cast<char32_t>(p[i + j]));
+    }
+    i += ascii;
+    if (i == size) {
+      break;
+    }
+
+    char32_t ch;
+    size_t len = DecodeSequence(p + i, size - i, ch);
+    if (len == 0) {
+      out.clear();
+      return false;
+    }
+
+    out.push_back(ch);
+    i += len;
+  }
+
+  return true;
+}
+
+bool EncodeU8(const char32_t* data, size_t size, std::string& out) {
+  out.clear();
+  out.reserve(size);
+
+  for (size_t i = 0; i < size; ++i) {
+    uint32_t ch = static_cast<uint32_t>(data[i]);
+    if (ch < 0x80) {
+      out.push_back(static_cast<char>(ch));
+    } else if (ch < 0x800) {
+      out.push_back(static_cast<char>(0xC0 | (ch >> 6)));
+      out.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+    } else if (ch < 0x10000) {
+      if (ch >= 0xD800 && ch <= 0xDFFF) {
+        out.clear();
+        return false;
+      }
+      out.push_back(static_cast<char>(0xE0 | (ch >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+    } else if (ch <= 0x10FFFF) {
+      out.push_back(static_cast<char>(0xF0 | (ch >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((ch >> 12) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+    } else {
+      out.clear();
+      return false;
+    }
+  }
+
+  return true;
+}
+
 }  // namespace ass
\ No newline at end of file
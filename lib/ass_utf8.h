@@ -20,6 +20,7 @@
 #ifndef ASSFONTS_ASSUTF8_H_
 #define ASSFONTS_ASSUTF8_H_
 
+#include <cstddef>
 #include <cstdlib>
 #include <iterator>
 #include <string>
@@ -33,6 +34,15 @@ namespace ass {
 
 unsigned char* StrToLwrExt(unsigned char* pString);
 
+// Validating UTF-8 <-> UTF-32 codecs. Overlong forms, surrogates and code
+// points above U+10FFFF are rejected: the functions return false and leave
+// out empty.
+bool DecodeU8(const char* data, size_t size, std::u32string& out);
+bool EncodeU8(const char32_t* data, size_t size, std::string& out);
+
+// Checks that data is well-formed UTF-8, by the same rules as DecodeU8()
+bool IsValidU8(const char* data, size_t size);
+
 template <typename StringType,
           typename = typename std::enable_if<
               std::is_same<StringType, std::string>::value ||
@@ -53,6 +63,10 @@ class U8Iterator {
   U8Iterator(const StringType& str, bool end = false)
       : str_(&str), pos_(end ? str.size() : 0){};
 
+  // Starts at a byte offset, which must be the first byte of a character
+  U8Iterator(const StringType& str, typename StringType::size_type pos)
+      : str_(&str), pos_(pos < str.size() ? pos : str.size()){};
+
   value_type operator*() {
     if (pos_ >= str_->size()) {
       return EOS;
@@ -21,6 +21,7 @@
 
 #include <condition_variable>
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <queue>
@@ -34,11 +35,14 @@
 #include "ass_logger.h"
 #include "ass_parser.h"
 #include "ass_string.h"
+#include "font_face_cache.h"
 #include "font_parser.h"
 #include "font_subsetter.h"
+#include "subset_cache.h"
 
 namespace fs = ghc::filesystem;
 
+
 struct LogType {
   ASSFONTS_LOG_LEVEL level;
   std::string msg;
@@ -103,6 +107,42 @@ void ConsumeQueue(std::shared_ptr<ass::Logger> logger, LogQueue& queue,
   }
 }
 
+// Returns a logger that queues its messages, so that tasks running in
+// parallel can have their logs shown one file after another.
+std::shared_ptr<ass::Logger> MakeQueueLogger(
+    LogQueue& queue, std::mutex& mtx, std::condition_variable& cv,
+    const ASSFONTS_LOG_LEVEL log_level) {
+  auto log_callback = [&queue, &mtx, &cv](const char* msg,
+                                          const ASSFONTS_LOG_LEVEL level) {
+    LogType log = {level, std::string(msg)};
+    std::unique_lock<std::mutex> lock(mtx);
+    queue.queue.push(log);
+    lock.unlock();
+    cv.notify_all();
+  };
+
+  return std::make_shared<ass::Logger>(ass::Logger(log_callback, log_level));
+}
+
+void FinishQueue(LogQueue& queue, std::condition_variable& cv) {
+  queue.is_finished = true;
+  cv.notify_all();
+}
+
+void LoadFontsDB(ass::FontParser& fp, const fs::path& db) {
+  fs::path db_file(db.native() + fs::path::preferred_separator +
+                   _ST("fonts.db"));
+  fs::path json_file(db.native() + fs::path::preferred_separator +
+                     _ST("fonts.json"));
+
+  // Databases built by older versions are JSON and get converted on load.
+  if (!fs::is_regular_file(db_file) && fs::is_regular_file(json_file)) {
+    fp.LoadDB(json_file.native());
+  } else {
+    fp.LoadDB(db_file.native());
+  }
+}
+
 void AssfontsBuildDB(const char** fonts_paths, const unsigned int num_fonts,
                      const char* db_path, const AssfontsLogCallback cb,
                      const enum ASSFONTS_LOG_LEVEL log_level) {
@@ -129,11 +169,11 @@ void AssfontsBuildDB(const char** fonts_paths, const unsigned int num_fonts,
     paths.emplace_back(path.native());
   }
 
-  fp.LoadDB(db.native() + fs::path::preferred_separator + _ST("fonts.json"));
+  LoadFontsDB(fp, db);
 
   fp.LoadFonts(paths);
 
-  fp.SaveDB(db.native() + fs::path::preferred_separator + _ST("fonts.json"));
+  fp.SaveDB(db.native() + fs::path::preferred_separator + _ST("fonts.db"));
 }
 
 void AssfontsRun(const char** input_paths, const unsigned int num_paths,
@@ -143,6 +183,11 @@ void AssfontsRun(const char** input_paths, const unsigned int num_paths,
                  const unsigned int is_subset_only,
                  const unsigned int is_embed_only, const unsigned int is_rename,
                  const unsigned int is_font_combined,
+                 const unsigned int is_combined_embed,
+                 const unsigned int is_no_subfont_files,
+                 const unsigned int is_no_intermediate_files,
+                 const unsigned int face_cache_size,
+                 const unsigned int subset_cache_size,
                  const unsigned int num_thread, const AssfontsLogCallback cb,
                  const enum ASSFONTS_LOG_LEVEL log_level) {
   auto logger = std::make_shared<ass::Logger>(ass::Logger(cb, log_level));
@@ -180,43 +225,55 @@ void AssfontsRun(const char** input_paths, const unsigned int num_paths,
     fp.LoadFonts(paths, false);
   }
 
-  fp.LoadDB(db.native() + fs::path::preferred_separator + _ST("fonts.json"));
+  LoadFontsDB(fp, db);
+
+  // The subset cache is only opened when something will be subsetted, and
+  // a size of 0 turns it off.
+  std::shared_ptr<ass::SubsetCache> subset_cache;
+  if (subset_cache_size != 0 && (is_font_combined || !is_embed_only)) {
+    subset_cache = std::make_shared<ass::SubsetCache>(
+        db.native() + fs::path::preferred_separator + _ST("subset_cache"),
+        uintmax_t(subset_cache_size) << 20);
+  }
+
+  auto face_cache =
+      std::make_shared<ass::FontFaceCache>(uintmax_t(face_cache_size) << 20);
+
+  // Font-combined mode only embeds when it is asked to
+  const bool is_no_embed =
+      is_subset_only || (is_font_combined && !is_combined_embed);
+
+  // The renamed and cleaned scripts are the output when nothing is embedded
+  const bool is_write_intermediates = is_no_embed || !is_no_intermediate_files;
 
+  // Subsetting runs nested inside the per-file tasks, so it gets its own
+  // pool to keep those tasks from waiting on themselves.
+  ThreadPool subset_pool(num_thread);
   ThreadPool pool(num_thread);
 
   std::vector<LogQueue> queues(num_paths);
   std::vector<std::mutex> mtxs(num_paths);
   std::vector<std::condition_variable> cvs(num_paths);
 
-  std::vector<ass::AssParser> aps;
-  std::map<ass::AssParser::FontDesc, std::unordered_set<char32_t>> font_sets;
+  std::vector<std::unique_ptr<ass::AssParser>> aps(num_paths);
+  std::map<ass::AssParser::FontDesc, ass::CodepointSet> font_sets;
   std::mutex font_sets_mtx;
 
   for (unsigned int idx = 0; idx < num_paths; ++idx) {
     pool.enqueue([=, &fp, &queues, &mtxs, &cvs, &font_sets, &font_sets_mtx,
-                  &aps]() {
-      auto finish = [&]() {
-        queues[idx].is_finished = true;
-        cvs[idx].notify_all();
-      };
-
-      auto log_callback = [&](const char* msg,
-                              const ASSFONTS_LOG_LEVEL log_level) {
-        LogType log = {log_level, std::string(msg)};
-        std::unique_lock<std::mutex> lock(mtxs[idx]);
-        queues[idx].queue.push(log);
-        lock.unlock();
-        cvs[idx].notify_all();
-      };
+                  &aps, &subset_pool]() {
+      auto finish = [&]() { FinishQueue(queues[idx], cvs[idx]); };
 
       auto t_logger =
-          std::make_shared<ass::Logger>(ass::Logger(log_callback, log_level));
+          MakeQueueLogger(queues[idx], mtxs[idx], cvs[idx], log_level);
 
       ass::AssParser ap(t_logger);
 
       fs::path input(input_paths[idx]);
 
       ap.set_output_dir_path(output.native());
+      ap.set_write_cleaned(is_write_intermediates);
+      ap.SetThreadPool(&subset_pool);
 
       if (brightness != 0) {
         if (!ap.Recolorize(input.native(), brightness)) {
@@ -240,12 +297,12 @@ void AssfontsRun(const char** input_paths, const unsigned int num_paths,
           if (font_sets.find(font_set.first) == font_sets.end()) {
             font_sets[font_set.first] = font_set.second;
           } else {
-            font_sets[font_set.first].insert(font_set.second.begin(),
-                                             font_set.second.end());
+            font_sets[font_set.first].Union(font_set.second);
           }
         }
 
-        aps.emplace_back(std::move(ap));
+        aps[idx] = std::unique_ptr<ass::AssParser>(
+            new ass::AssParser(std::move(ap)));
 
         return finish();
       }
@@ -255,10 +312,14 @@ void AssfontsRun(const char** input_paths, const unsigned int num_paths,
       }
 
       ass::FontSubsetter fsub(fp, ap.get_font_sets(), t_logger);
+      fsub.SetSubsetCache(subset_cache);
+      fsub.SetThreadPool(&subset_pool);
+      fsub.SetFontFaceCache(face_cache);
 
       if (!is_embed_only) {
         fsub.SetSubfontDir(output.native() + fs::path::preferred_separator +
                            input.stem().native() + _ST("_subsetted"));
+        fsub.SetWriteSubfonts(is_subset_only || !is_no_subfont_files);
       }
 
       if (!fsub.Run(is_embed_only, is_rename)) {
@@ -268,6 +329,7 @@ void AssfontsRun(const char** input_paths, const unsigned int num_paths,
       ass::AssFontEmbedder afe(ap, fsub.get_subfonts_info(), t_logger);
 
       afe.set_output_dir_path(output.native());
+      afe.set_write_renamed(is_write_intermediates);
       if (!afe.Run(is_subset_only, is_embed_only, is_rename)) {
         return finish();
       }
@@ -288,23 +350,69 @@ void AssfontsRun(const char** input_paths, const unsigned int num_paths,
     logger->Text("");
 
     ass::FontSubsetter fsub(fp, font_sets, logger);
+    fsub.SetSubsetCache(subset_cache);
+    fsub.SetThreadPool(&subset_pool);
+    fsub.SetFontFaceCache(face_cache);
     fsub.SetSubfontDir(output.native() + fs::path::preferred_separator +
                        _ST("subsetted_fonts"));
+    fsub.SetWriteSubfonts(is_no_embed || !is_no_subfont_files);
 
     if (!fsub.Run(false, is_rename)) {
       return;
     }
 
-    for (const auto& ap : aps) {
-      logger->Text("");
+    const auto subfonts_info = fsub.get_subfonts_info();
 
-      ass::AssFontEmbedder afe(ap, fsub.get_subfonts_info(), logger);
+    // Every file embeds the same subfonts, so encode them only once.
+    std::shared_ptr<const ass::AssFontEmbedder::FontBlocks> font_blocks;
+    if (!is_no_embed) {
+      font_blocks = ass::AssFontEmbedder::EncodeFonts(subfonts_info, logger);
+    }
 
-      afe.set_output_dir_path(output.native());
+    std::vector<LogQueue> embed_queues(num_paths);
+    std::vector<std::mutex> embed_mtxs(num_paths);
+    std::vector<std::condition_variable> embed_cvs(num_paths);
+    std::vector<std::future<void>> results;
 
-      if (!afe.Run(true, false, is_rename)) {
-        return;
+    for (unsigned int idx = 0; idx < num_paths; ++idx) {
+      if (!aps[idx]) {
+        continue;
       }
+
+      results.emplace_back(pool.enqueue([=, &aps, &subfonts_info,
+                                         &font_blocks, &embed_queues,
+                                         &embed_mtxs, &embed_cvs]() {
+        auto t_logger = MakeQueueLogger(embed_queues[idx], embed_mtxs[idx],
+                                        embed_cvs[idx], log_level);
+
+        // The parser's own queue was consumed after the first phase, so
+        // anything it reports while the script is embedded goes here.
+        aps[idx]->set_logger(t_logger);
+
+        ass::AssFontEmbedder afe(*aps[idx], subfonts_info, t_logger);
+
+        afe.set_output_dir_path(output.native());
+        afe.set_font_blocks(font_blocks);
+        afe.set_write_renamed(is_write_intermediates);
+        afe.Run(is_no_embed, false, is_rename);
+
+        FinishQueue(embed_queues[idx], embed_cvs[idx]);
+      }));
+    }
+
+    for (unsigned int idx = 0; idx < num_paths; ++idx) {
+      if (!aps[idx]) {
+        continue;
+      }
+
+      logger->Text("");
+      ConsumeQueue(logger, embed_queues[idx], embed_mtxs[idx],
+                   embed_cvs[idx]);
+    }
+
+    // Wait for the tasks to let go of the queues before they are destroyed
+    for (auto& result : results) {
+      result.get();
     }
   }
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_BOUNDEDQUEUE_H_
+#define ASSFONTS_BOUNDEDQUEUE_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <utility>
+
+namespace ass {
+
+// Multi-producer, multi-consumer FIFO holding at most capacity items.
+// Push blocks while the queue is full and Pop blocks while it is empty.
+// After Close, Push fails and Pop drains the remaining items.
+template <class T>
+class BoundedQueue {
+ public:
+  BoundedQueue(const size_t capacity) : capacity_(capacity){};
+  ~BoundedQueue() = default;
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    not_full_.wait(lock,
+                   [this]() { return is_closed_ || queue_.size() < capacity_; });
+    if (is_closed_) {
+      return false;
+    }
+    queue_.push(std::move(item));
+    lock.unlock();
+    not_empty_.notify_one();
+    return true;
+  }
+
+  bool Pop(T& item) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    not_empty_.wait(lock, [this]() { return is_closed_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return false;
+    }
+    item = std::move(queue_.front());
+    queue_.pop();
+    lock.unlock();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      is_closed_ = true;
+    }
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+ private:
+  const size_t capacity_;
+  std::queue<T> queue_;
+  bool is_closed_ = false;
+  std::mutex mtx_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+}  // namespace ass
+
+#endif
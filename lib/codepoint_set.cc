@@ -0,0 +1,157 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include "codepoint_set.h"
+
+#include <algorithm>
+#include <bitset>
+
+namespace ass {
+
+namespace {
+
+size_t CountBits(const uint64_t word) {
+  return std::bitset<64>(word).count();
+}
+
+}  // namespace
+
+uint32_t CodepointSet::Iterator::operator*() const {
+  return (set_->pages_[page_].key << PAGE_BITS) | bit_;
+}
+
+CodepointSet::Iterator& CodepointSet::Iterator::operator++() {
+  ++bit_;
+  SkipToSet();
+  return *this;
+}
+
+CodepointSet::Iterator CodepointSet::Iterator::operator++(int) {
+  Iterator res(*this);
+  ++(*this);
+  return res;
+}
+
+// Moves forward to the first set bit at or after the current position
+void CodepointSet::Iterator::SkipToSet() {
+  const auto& pages = set_->pages_;
+  while (page_ < pages.size()) {
+    while (bit_ < PAGE_WORDS * 64) {
+      uint64_t word = pages[page_].words[bit_ >> 6] >> (bit_ & 63);
+      if (word == 0) {
+        bit_ = (bit_ | 63) + 1;
+        continue;
+      }
+      while ((word & 1) == 0) {
+        word >>= 1;
+        ++bit_;
+      }
+      return;
+    }
+    ++page_;
+    bit_ = 0;
+  }
+  bit_ = 0;
+}
+
+void CodepointSet::InsertRange(const uint32_t first, const uint32_t last) {
+  for (uint64_t codepoint = first; codepoint <= last; ++codepoint) {
+    Insert(static_cast<uint32_t>(codepoint));
+  }
+}
+
+bool CodepointSet::Contains(const uint32_t codepoint) const {
+  const uint32_t key = codepoint >> PAGE_BITS;
+  auto page = std::lower_bound(
+      pages_.begin(), pages_.end(), key,
+      [](const Page& page, const uint32_t key) { return page.key < key; });
+  if (page == pages_.end() || page->key != key) {
+    return false;
+  }
+  return (page->words[(codepoint >> 6) & WORD_MASK] >> (codepoint & 63)) & 1;
+}
+
+void CodepointSet::Union(const CodepointSet& other) {
+  std::vector<Page> merged;
+  merged.reserve(pages_.size() + other.pages_.size());
+  auto lhs = pages_.begin();
+  auto rhs = other.pages_.begin();
+  while (lhs != pages_.end() || rhs != other.pages_.end()) {
+    if (rhs == other.pages_.end() ||
+        (lhs != pages_.end() && lhs->key < rhs->key)) {
+      merged.emplace_back(*lhs++);
+    } else if (lhs == pages_.end() || rhs->key < lhs->key) {
+      merged.emplace_back(*rhs++);
+    } else {
+      Page page = *lhs++;
+      for (unsigned int i = 0; i < PAGE_WORDS; ++i) {
+        page.words[i] |= rhs->words[i];
+      }
+      merged.emplace_back(page);
+      ++rhs;
+    }
+  }
+
+  size_ = 0;
+  for (const auto& page : merged) {
+    for (const auto& word : page.words) {
+      size_ += CountBits(word);
+    }
+  }
+  pages_.swap(merged);
+  last_page_ = 0;
+}
+
+CodepointSet::Iterator CodepointSet::begin() const {
+  Iterator iter(this, 0, 0);
+  iter.SkipToSet();
+  return iter;
+}
+
+CodepointSet::Iterator CodepointSet::end() const {
+  return Iterator(this, pages_.size(), 0);
+}
+
+bool CodepointSet::operator==(const CodepointSet& rhs) const {
+  if (size_ != rhs.size_ || pages_.size() != rhs.pages_.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < pages_.size(); ++i) {
+    if (pages_[i].key != rhs.pages_[i].key ||
+        pages_[i].words != rhs.pages_[i].words) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t CodepointSet::FindOrAddPage(const uint32_t key) {
+  auto page = std::lower_bound(
+      pages_.begin(), pages_.end(), key,
+      [](const Page& page, const uint32_t key) { return page.key < key; });
+  if (page == pages_.end() || page->key != key) {
+    Page new_page;
+    new_page.key = key;
+    new_page.words.fill(0);
+    page = pages_.insert(page, new_page);
+  }
+  return static_cast<size_t>(page - pages_.begin());
+}
+
+}  // namespace ass
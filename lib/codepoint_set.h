@@ -0,0 +1,125 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_CODEPOINTSET_H_
+#define ASSFONTS_CODEPOINTSET_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace ass {
+
+// Inclusive range of Unicode codepoints. Coverage is kept as a sorted list
+// of non-overlapping ranges, which is also how the fonts database stores
+// it, so matches can refer to the mapped ranges directly.
+struct CodepointRange {
+  uint32_t first;
+  uint32_t last;
+};
+
+// Set of Unicode codepoints stored as a sorted list of 512-bit pages.
+// Inserting into the page used last is a single bit operation, and
+// iteration visits codepoints in ascending order.
+class CodepointSet {
+ public:
+  class Iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = uint32_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const uint32_t*;
+    using reference = uint32_t;
+
+    uint32_t operator*() const;
+
+    Iterator& operator++();
+    Iterator operator++(int);
+
+    bool operator==(const Iterator& rhs) const {
+      return page_ == rhs.page_ && bit_ == rhs.bit_;
+    }
+    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); }
+
+   private:
+    friend class CodepointSet;
+
+    Iterator(const CodepointSet* set, size_t page, unsigned int bit)
+        : set_(set), page_(page), bit_(bit){};
+
+    const CodepointSet* set_;
+    size_t page_;
+    unsigned int bit_;
+
+    void SkipToSet();
+  };
+
+  CodepointSet() = default;
+  ~CodepointSet() = default;
+
+  void Insert(const uint32_t codepoint) {
+    const uint32_t key = codepoint >> PAGE_BITS;
+    if (last_page_ >= pages_.size() || pages_[last_page_].key != key) {
+      last_page_ = FindOrAddPage(key);
+    }
+    uint64_t& word = pages_[last_page_].words[(codepoint >> 6) & WORD_MASK];
+    const uint64_t mask = uint64_t(1) << (codepoint & 63);
+    size_ += (word & mask) == 0;
+    word |= mask;
+  }
+
+  void InsertRange(const uint32_t first, const uint32_t last);
+
+  bool Contains(const uint32_t codepoint) const;
+
+  void Union(const CodepointSet& other);
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  Iterator begin() const;
+
+  Iterator end() const;
+
+  bool operator==(const CodepointSet& rhs) const;
+  bool operator!=(const CodepointSet& rhs) const { return !(*this == rhs); }
+
+ private:
+  static constexpr unsigned int PAGE_BITS = 9;
+  static constexpr unsigned int PAGE_WORDS = 8;
+  static constexpr unsigned int WORD_MASK = PAGE_WORDS - 1;
+
+  struct Page {
+    uint32_t key;
+    std::array<uint64_t, PAGE_WORDS> words;
+  };
+
+  std::vector<Page> pages_;
+  size_t size_ = 0;
+  size_t last_page_ = 0;
+
+  size_t FindOrAddPage(const uint32_t key);
+};
+
+}  // namespace ass
+
+#endif
@@ -0,0 +1,174 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include "dir_walker.h"
+
+#include <algorithm>
+#include <memory>
+
+#ifdef _WIN32
+#include <ghc/filesystem.hpp>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace ass {
+
+DirWalker::DirWalker(ThreadPool& pool, const std::vector<AString>& suffixes)
+    : pool_(pool) {
+  for (const auto& suffix : suffixes) {
+    suffixes_.emplace_back(ToLower(suffix));
+  }
+}
+
+void DirWalker::Walk(const AString& root, const FileCallback& on_file,
+                     const ErrorCallback& on_error) {
+  Enqueue(root, on_file, on_error);
+
+  std::unique_lock<std::mutex> lock(mtx_);
+  cv_.wait(lock, [this]() { return num_pending_ == 0; });
+
+  if (error_) {
+    std::exception_ptr error = error_;
+    error_ = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void DirWalker::Enqueue(const AString& dir_path, const FileCallback& on_file,
+                        const ErrorCallback& on_error) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    ++num_pending_;
+  }
+
+  pool_.enqueue([this, dir_path, &on_file, &on_error]() {
+    // The directory has to be counted as done however it ends, or Walk()
+    // would wait forever
+    std::exception_ptr error;
+    try {
+      WalkDir(dir_path, on_file, on_error);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (error && !error_) {
+      error_ = error;
+    }
+    if (--num_pending_ == 0) {
+      cv_.notify_all();
+    }
+  });
+}
+
+#ifdef _WIN32
+void DirWalker::WalkDir(const AString& dir_path, const FileCallback& on_file,
+                        const ErrorCallback& on_error) {
+  namespace fs = ghc::filesystem;
+
+  // The directory iterator caches the attributes returned by
+  // FindNextFileW, so no entry is stat'ed again.
+  std::error_code ec;
+  fs::directory_iterator iter(fs::path(dir_path), ec);
+  if (ec) {
+    on_error(dir_path);
+    return;
+  }
+
+  for (const auto& entry : iter) {
+    std::error_code entry_ec;
+    if (entry.is_symlink(entry_ec)) {
+      if (IsMatched(entry.path().filename().native()) &&
+          entry.is_regular_file(entry_ec)) {
+        on_file(entry.path().native());
+      }
+    } else if (entry.is_directory(entry_ec)) {
+      Enqueue(entry.path().native(), on_file, on_error);
+    } else if (entry.is_regular_file(entry_ec) &&
+               IsMatched(entry.path().filename().native())) {
+      on_file(entry.path().native());
+    }
+  }
+}
+#else
+void DirWalker::WalkDir(const AString& dir_path, const FileCallback& on_file,
+                        const ErrorCallback& on_error) {
+  // Closed however the walk ends, including when a callback throws
+  std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(dir_path.c_str()),
+                                          &closedir);
+  if (dir == nullptr) {
+    on_error(dir_path);
+    return;
+  }
+
+  const AString prefix =
+      (!dir_path.empty() && dir_path.back() == '/') ? dir_path : dir_path + '/';
+
+  while (const dirent* entry = readdir(dir.get())) {
+    const AString name(entry->d_name);
+    if (name == "." || name == "..") {
+      continue;
+    }
+
+    const AString path = prefix + name;
+    unsigned char type = entry->d_type;
+
+    // Only file systems that do not report the type need an lstat.
+    if (type == DT_UNKNOWN) {
+      struct stat buffer;
+      if (lstat(path.c_str(), &buffer)) {
+        continue;
+      }
+      if (S_ISDIR(buffer.st_mode)) {
+        type = DT_DIR;
+      } else if (S_ISREG(buffer.st_mode)) {
+        type = DT_REG;
+      } else if (S_ISLNK(buffer.st_mode)) {
+        type = DT_LNK;
+      }
+    }
+
+    if (type == DT_DIR) {
+      Enqueue(path, on_file, on_error);
+    } else if (type == DT_REG) {
+      if (IsMatched(name)) {
+        on_file(path);
+      }
+    } else if (type == DT_LNK && IsMatched(name)) {
+      struct stat buffer;
+      if (!stat(path.c_str(), &buffer) && S_ISREG(buffer.st_mode)) {
+        on_file(path);
+      }
+    }
+  }
+}
+#endif
+
+bool DirWalker::IsMatched(const AString& file_name) const {
+  return std::any_of(
+      suffixes_.begin(), suffixes_.end(), [&](const AString& suffix) {
+        return file_name.size() >= suffix.size() &&
+               ToLower(file_name.substr(file_name.size() - suffix.size())) ==
+                   suffix;
+      });
+}
+
+}  // namespace ass
@@ -0,0 +1,72 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_DIRWALKER_H_
+#define ASSFONTS_DIRWALKER_H_
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "ass_string.h"
+
+namespace ass {
+
+// Walks a directory tree in parallel with one pool task per directory.
+// Regular files whose name ends with one of the suffixes (compared case
+// insensitively) are reported as soon as they are found. Symbolic links to
+// directories are not followed.
+class DirWalker {
+ public:
+  using FileCallback = std::function<void(const AString& file_path)>;
+  using ErrorCallback = std::function<void(const AString& dir_path)>;
+
+  DirWalker(ThreadPool& pool, const std::vector<AString>& suffixes);
+  ~DirWalker() = default;
+
+  DirWalker(const DirWalker&) = delete;
+  DirWalker& operator=(const DirWalker&) = delete;
+
+  // Blocks until the whole tree is walked. Callbacks run concurrently on the
+  // pool threads. The first exception thrown by a callback is rethrown here
+  // after the remaining directories are done.
+  void Walk(const AString& root, const FileCallback& on_file,
+            const ErrorCallback& on_error);
+
+ private:
+  ThreadPool& pool_;
+  std::vector<AString> suffixes_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  size_t num_pending_ = 0;
+  std::exception_ptr error_;
+
+  void WalkDir(const AString& dir_path, const FileCallback& on_file,
+               const ErrorCallback& on_error);
+  void Enqueue(const AString& dir_path, const FileCallback& on_file,
+               const ErrorCallback& on_error);
+  bool IsMatched(const AString& file_name) const;
+};
+
+}  // namespace ass
+
+#endif
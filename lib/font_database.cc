@@ -0,0 +1,410 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include "font_database.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ass {
+
+static constexpr char DB_MAGIC[8] = {'A', 'S', 'S', 'F', 'O', 'N', 'T', 'S'};
+static constexpr uint32_t DB_VERSION = 3;
+static constexpr uint32_t FACE_HAS_COVERAGE = 1;
+static constexpr uint32_t DB_BYTE_ORDER = 0x01020304;
+
+bool FontDatabase::IsBinary(const char* data, const size_t size) {
+  return size >= sizeof(DB_MAGIC) &&
+         std::memcmp(data, DB_MAGIC, sizeof(DB_MAGIC)) == 0;
+}
+
+std::string FontDatabase::Serialize(
+    const std::unordered_multimap<AString, FontParser::FontInfo>& font_list) {
+  std::vector<std::pair<std::string, const FontParser::FontInfo*>> fonts;
+  fonts.reserve(font_list.size());
+
+  for (const auto& font : font_list) {
+#ifdef _WIN32
+    fonts.emplace_back(WideToU8(font.first), &font.second);
+#else
+    fonts.emplace_back(font.first, &font.second);
+#endif
+  }
+
+  std::sort(fonts.begin(), fonts.end(), [](const auto& a, const auto& b) {
+    return (a.first < b.first) ||
+           (a.first == b.first && a.second->index < b.second->index);
+  });
+
+  std::string pool;
+  std::unordered_map<std::string, uint32_t> pool_offsets;
+
+  auto add_string = [&](const std::string& str) {
+    auto iter = pool_offsets.find(str);
+    if (iter != pool_offsets.end()) {
+      return iter->second;
+    }
+    const auto offset = static_cast<uint32_t>(pool.size());
+    pool.append(str);
+    pool_offsets.emplace(str, offset);
+    return offset;
+  };
+
+  std::vector<FaceRecord> faces;
+  std::vector<NameRecord> face_names;
+  std::vector<RangeRecord> ranges;
+  faces.reserve(fonts.size());
+
+  for (uint32_t face = 0; face < fonts.size(); ++face) {
+    const auto& path = fonts[face].first;
+    const auto& info = *fonts[face].second;
+
+    FaceRecord record = {};
+    record.path_offset = add_string(path);
+    record.path_size = static_cast<uint32_t>(path.size());
+    record.index = static_cast<int32_t>(info.index);
+    record.weight = info.weight;
+    record.slant = info.slant;
+    record.device = info.fingerprint.device;
+    record.inode = info.fingerprint.inode;
+    record.file_size = info.fingerprint.size;
+    record.mtime_ns = info.fingerprint.mtime_ns;
+    record.names_begin = static_cast<uint32_t>(face_names.size());
+
+    auto add_names = [&](const std::vector<std::string>& names,
+                         const NameKind kind) {
+      for (const auto& name : names) {
+        NameRecord name_record = {add_string(name),
+                                  static_cast<uint32_t>(name.size()), kind,
+                                  face};
+        face_names.emplace_back(name_record);
+      }
+    };
+
+    add_names(info.families, FAMILY);
+    add_names(info.fullnames, FULLNAME);
+    add_names(info.psnames, PSNAME);
+
+    record.names_count =
+        static_cast<uint32_t>(face_names.size()) - record.names_begin;
+
+    record.flags = info.has_coverage ? FACE_HAS_COVERAGE : 0;
+    record.ranges_begin = static_cast<uint32_t>(ranges.size());
+    ranges.insert(ranges.end(), info.coverage.begin(), info.coverage.end());
+    record.ranges_count = static_cast<uint32_t>(info.coverage.size());
+
+    faces.emplace_back(record);
+  }
+
+  std::vector<NameRecord> names(face_names);
+  std::sort(names.begin(), names.end(),
+            [&](const NameRecord& a, const NameRecord& b) {
+              auto name_a = nonstd::string_view(&pool[a.offset], a.size);
+              auto name_b = nonstd::string_view(&pool[b.offset], b.size);
+              return (name_a < name_b) || (name_a == name_b && a.face < b.face);
+            });
+
+  Header header = {};
+  std::memcpy(header.magic, DB_MAGIC, sizeof(DB_MAGIC));
+  header.version = DB_VERSION;
+  header.byte_order = DB_BYTE_ORDER;
+  header.num_faces = static_cast<uint32_t>(faces.size());
+  header.num_names = static_cast<uint32_t>(names.size());
+  header.faces_offset = sizeof(Header);
+  header.face_names_offset = static_cast<uint32_t>(
+      header.faces_offset + faces.size() * sizeof(FaceRecord));
+  header.names_offset = static_cast<uint32_t>(
+      header.face_names_offset + face_names.size() * sizeof(NameRecord));
+  header.num_ranges = static_cast<uint32_t>(ranges.size());
+  header.ranges_offset = static_cast<uint32_t>(
+      header.names_offset + names.size() * sizeof(NameRecord));
+  header.pool_offset = static_cast<uint32_t>(
+      header.ranges_offset + ranges.size() * sizeof(RangeRecord));
+  header.pool_size = static_cast<uint32_t>(pool.size());
+
+  std::string image;
+  image.reserve(header.pool_offset + pool.size());
+  image.append(reinterpret_cast<const char*>(&header), sizeof(Header));
+  image.append(reinterpret_cast<const char*>(faces.data()),
+               faces.size() * sizeof(FaceRecord));
+  image.append(reinterpret_cast<const char*>(face_names.data()),
+               face_names.size() * sizeof(NameRecord));
+  image.append(reinterpret_cast<const char*>(names.data()),
+               names.size() * sizeof(NameRecord));
+  image.append(reinterpret_cast<const char*>(ranges.data()),
+               ranges.size() * sizeof(RangeRecord));
+  image.append(pool);
+
+  return image;
+}
+
+bool FontDatabase::Open(const AString& db_path) {
+  if (!file_.Open(db_path)) {
+    return false;
+  }
+
+  if (!Attach(file_.data(), file_.size())) {
+    file_.Close();
+    return false;
+  }
+
+  return true;
+}
+
+bool FontDatabase::Assign(std::string image) {
+  file_.Close();
+  image_ = std::move(image);
+
+  if (!Attach(image_.data(), image_.size())) {
+    image_.clear();
+    return false;
+  }
+
+  return true;
+}
+
+size_t FontDatabase::size() const {
+  return header_ ? header_->num_faces : 0;
+}
+
+AString FontDatabase::get_path(const uint32_t face) const {
+  auto path = GetString(faces_[face].path_offset, faces_[face].path_size);
+#ifdef _WIN32
+  return U8ToWide(std::string(path));
+#else
+  return AString(path);
+#endif
+}
+
+long FontDatabase::get_index(const uint32_t face) const {
+  return faces_[face].index;
+}
+
+int FontDatabase::get_weight(const uint32_t face) const {
+  return faces_[face].weight;
+}
+
+int FontDatabase::get_slant(const uint32_t face) const {
+  return faces_[face].slant;
+}
+
+bool FontDatabase::get_coverage(const uint32_t face,
+                                const CodepointRange*& coverage,
+                                size_t& size) const {
+  if (!(faces_[face].flags & FACE_HAS_COVERAGE)) {
+    coverage = nullptr;
+    size = 0;
+    return false;
+  }
+  coverage = ranges_ + faces_[face].ranges_begin;
+  size = faces_[face].ranges_count;
+  return true;
+}
+
+std::vector<std::pair<uint32_t, FontDatabase::NameKind>>
+FontDatabase::FindName(const std::string& name) const {
+  std::vector<std::pair<uint32_t, NameKind>> res;
+
+  if (header_ == nullptr) {
+    return res;
+  }
+
+  const nonstd::string_view key(name);
+  auto iter = std::lower_bound(
+      names_, names_ + header_->num_names, key,
+      [this](const NameRecord& record, const nonstd::string_view key) {
+        return GetString(record.offset, record.size) < key;
+      });
+
+  for (; iter != names_ + header_->num_names; ++iter) {
+    if (GetString(iter->offset, iter->size) != key) {
+      break;
+    }
+    res.emplace_back(iter->face, static_cast<NameKind>(iter->kind));
+  }
+
+  return res;
+}
+
+std::vector<FontParser::FontInfo> FontDatabase::FindPath(
+    const AString& font_path) const {
+  std::vector<FontParser::FontInfo> res;
+
+  if (header_ == nullptr) {
+    return res;
+  }
+
+#ifdef _WIN32
+  const std::string path_u8 = WideToU8(font_path);
+#else
+  const std::string& path_u8 = font_path;
+#endif
+  const nonstd::string_view key(path_u8);
+
+  auto iter = std::lower_bound(
+      faces_, faces_ + header_->num_faces, key,
+      [this](const FaceRecord& record, const nonstd::string_view key) {
+        return GetString(record.path_offset, record.path_size) < key;
+      });
+
+  for (; iter != faces_ + header_->num_faces; ++iter) {
+    if (GetString(iter->path_offset, iter->path_size) != key) {
+      break;
+    }
+
+    FontParser::FontInfo info;
+    info.weight = iter->weight;
+    info.slant = iter->slant;
+    info.index = iter->index;
+    info.fingerprint.device = iter->device;
+    info.fingerprint.inode = iter->inode;
+    info.fingerprint.size = iter->file_size;
+    info.fingerprint.mtime_ns = iter->mtime_ns;
+    const CodepointRange* coverage = nullptr;
+    size_t coverage_size = 0;
+    info.has_coverage = get_coverage(static_cast<uint32_t>(iter - faces_),
+                                     coverage, coverage_size);
+    info.coverage.assign(coverage, coverage + coverage_size);
+
+    for (uint32_t idx = iter->names_begin;
+         idx < iter->names_begin + iter->names_count; ++idx) {
+      const auto& record = face_names_[idx];
+      auto name = std::string(GetString(record.offset, record.size));
+      switch (record.kind) {
+        case FAMILY:
+          info.families.emplace_back(name);
+          break;
+        case FULLNAME:
+          info.fullnames.emplace_back(name);
+          break;
+        case PSNAME:
+          info.psnames.emplace_back(name);
+          break;
+        default:
+          break;
+      }
+    }
+
+    res.emplace_back(info);
+  }
+
+  return res;
+}
+
+bool FontDatabase::Attach(const char* data, const size_t size) {
+  // Every section starts at a multiple of 8 so records can be read in place.
+  static_assert(sizeof(Header) % 8 == 0, "unaligned header");
+  static_assert(sizeof(FaceRecord) % 8 == 0, "unaligned face record");
+  static_assert(sizeof(NameRecord) % 8 == 0, "unaligned name record");
+
+  header_ = nullptr;
+
+  if (!IsBinary(data, size) || size < sizeof(Header)) {
+    return false;
+  }
+
+  const auto* header = reinterpret_cast<const Header*>(data);
+
+  if (header->version != DB_VERSION || header->byte_order != DB_BYTE_ORDER) {
+    return false;
+  }
+
+  auto in_range = [size](const uint64_t offset, const uint64_t length) {
+    return offset % 8 == 0 && offset + length <= size;
+  };
+
+  const uint64_t num_face_names =
+      (static_cast<uint64_t>(header->names_offset) -
+       header->face_names_offset) /
+      sizeof(NameRecord);
+
+  const uint64_t faces_size =
+      static_cast<uint64_t>(header->num_faces) * sizeof(FaceRecord);
+  const uint64_t names_size =
+      static_cast<uint64_t>(header->num_names) * sizeof(NameRecord);
+  const uint64_t ranges_size =
+      static_cast<uint64_t>(header->num_ranges) * sizeof(RangeRecord);
+
+  if (header->names_offset < header->face_names_offset ||
+      !in_range(header->faces_offset, faces_size) ||
+      !in_range(header->face_names_offset,
+                num_face_names * sizeof(NameRecord)) ||
+      !in_range(header->names_offset, names_size) ||
+      !in_range(header->ranges_offset, ranges_size) ||
+      static_cast<uint64_t>(header->pool_offset) + header->pool_size > size) {
+    return false;
+  }
+
+  const auto* faces =
+      reinterpret_cast<const FaceRecord*>(data + header->faces_offset);
+  const auto* face_names =
+      reinterpret_cast<const NameRecord*>(data + header->face_names_offset);
+  const auto* names =
+      reinterpret_cast<const NameRecord*>(data + header->names_offset);
+  const auto* ranges =
+      reinterpret_cast<const RangeRecord*>(data + header->ranges_offset);
+
+  auto valid_string = [header](const uint32_t offset, const uint32_t length) {
+    return static_cast<uint64_t>(offset) + length <= header->pool_size;
+  };
+
+  auto valid_name = [&](const NameRecord& record) {
+    return valid_string(record.offset, record.size) &&
+           record.kind <= PSNAME && record.face < header->num_faces;
+  };
+
+  for (uint32_t face = 0; face < header->num_faces; ++face) {
+    const auto& record = faces[face];
+    if (!valid_string(record.path_offset, record.path_size) ||
+        static_cast<uint64_t>(record.names_begin) + record.names_count >
+            num_face_names ||
+        static_cast<uint64_t>(record.ranges_begin) + record.ranges_count >
+            header->num_ranges) {
+      return false;
+    }
+  }
+
+  for (uint64_t idx = 0; idx < num_face_names; ++idx) {
+    if (!valid_name(face_names[idx])) {
+      return false;
+    }
+  }
+
+  for (uint32_t idx = 0; idx < header->num_names; ++idx) {
+    if (!valid_name(names[idx])) {
+      return false;
+    }
+  }
+
+  header_ = header;
+  faces_ = faces;
+  face_names_ = face_names;
+  names_ = names;
+  ranges_ = ranges;
+  pool_ = data + header->pool_offset;
+
+  return true;
+}
+
+nonstd::string_view FontDatabase::GetString(const uint32_t offset,
+                                            const uint32_t size) const {
+  return nonstd::string_view(pool_ + offset, size);
+}
+
+}  // namespace ass
@@ -0,0 +1,135 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_FONTDATABASE_H_
+#define ASSFONTS_FONTDATABASE_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <nonstd/string_view.hpp>
+
+#include "ass_mmap.h"
+#include "ass_string.h"
+#include "font_parser.h"
+
+namespace ass {
+
+// Binary fonts database. The file is a header followed by fixed-size face
+// records (sorted by path), the per-face name lists, a name index sorted by
+// name, the per-face codepoint coverage ranges and a string pool. It is
+// mapped read-only and queried in place.
+class FontDatabase {
+ public:
+  enum NameKind : uint32_t { FAMILY = 0, FULLNAME, PSNAME };
+
+  FontDatabase() = default;
+  ~FontDatabase() = default;
+
+  FontDatabase(const FontDatabase&) = delete;
+  FontDatabase& operator=(const FontDatabase&) = delete;
+
+  static bool IsBinary(const char* data, const size_t size);
+
+  static std::string Serialize(
+      const std::unordered_multimap<AString, FontParser::FontInfo>& font_list);
+
+  bool Open(const AString& db_path);
+
+  bool Assign(std::string image);
+
+  size_t size() const;
+
+  AString get_path(const uint32_t face) const;
+  long get_index(const uint32_t face) const;
+  int get_weight(const uint32_t face) const;
+  int get_slant(const uint32_t face) const;
+  bool get_coverage(const uint32_t face, const CodepointRange*& coverage,
+                    size_t& size) const;
+
+  std::vector<std::pair<uint32_t, NameKind>> FindName(
+      const std::string& name) const;
+
+  std::vector<FontParser::FontInfo> FindPath(const AString& font_path) const;
+
+ private:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_faces;
+    uint32_t num_names;
+    uint32_t faces_offset;
+    uint32_t face_names_offset;
+    uint32_t names_offset;
+    uint32_t num_ranges;
+    uint32_t ranges_offset;
+    uint32_t pool_offset;
+    uint32_t pool_size;
+    uint32_t reserved;
+  };
+
+  struct FaceRecord {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t file_size;
+    int64_t mtime_ns;
+    uint32_t path_offset;
+    uint32_t path_size;
+    int32_t index;
+    int32_t weight;
+    int32_t slant;
+    uint32_t names_begin;
+    uint32_t names_count;
+    uint32_t flags;
+    uint32_t ranges_begin;
+    uint32_t ranges_count;
+  };
+
+  struct NameRecord {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t kind;
+    uint32_t face;
+  };
+
+  using RangeRecord = CodepointRange;
+
+  MappedFile file_;
+  std::string image_;
+
+  const Header* header_ = nullptr;
+  const FaceRecord* faces_ = nullptr;
+  const NameRecord* face_names_ = nullptr;
+  const NameRecord* names_ = nullptr;
+  const RangeRecord* ranges_ = nullptr;
+  const char* pool_ = nullptr;
+
+  bool Attach(const char* data, const size_t size);
+
+  nonstd::string_view GetString(const uint32_t offset,
+                                const uint32_t size) const;
+};
+
+}  // namespace ass
+
+#endif
@@ -0,0 +1,160 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include "font_face_cache.h"
+
+#include <climits>
+
+namespace ass {
+
+FontFaceCache::FontFaceCache(const uintmax_t max_size)
+    : max_size_(max_size), library_(std::make_shared<Library>()) {
+  FT_Init_FreeType(&library_->ft_library.get());
+}
+
+std::shared_ptr<FontFaceCache::Face> FontFaceCache::Get(
+    const AString& font_path, const long font_index) {
+  const auto key = std::make_pair(font_path, font_index);
+  std::shared_ptr<MappedFile> file;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto iter = entries_.find(key);
+    if (iter != entries_.end()) {
+      lru_.splice(lru_.begin(), lru_, iter->second.lru_iter);
+      return iter->second.face;
+    }
+    // Faces of one collection share a single mapping.
+    file = FindMapping(font_path);
+  }
+
+  // The file is mapped and parsed without holding the cache lock, so a
+  // miss does not hold up lookups of other faces.
+  if (!file) {
+    file = std::make_shared<MappedFile>();
+    if (!file->Open(font_path)) {
+      return nullptr;
+    }
+  }
+
+  std::shared_ptr<Face> face(new Face());
+  face->library_ = library_;
+  face->file_ = file;
+  face->font_index_ = font_index;
+  hb_blob_t* hb_blob = hb_blob_create_or_fail(
+      file->data(), static_cast<unsigned int>(file->size()),
+      HB_MEMORY_MODE_READONLY, new std::shared_ptr<MappedFile>(file),
+      [](void* user_data) {
+        delete static_cast<std::shared_ptr<MappedFile>*>(user_data);
+      });
+  if (hb_blob == nullptr) {
+    return nullptr;
+  }
+  face->hb_face_ =
+      hb_face_create(hb_blob, static_cast<unsigned int>(font_index));
+  hb_blob_destroy(hb_blob);
+  // HarfBuzz hands out an empty face for data it cannot parse
+  if (hb_face_get_glyph_count(face->hb_face_) == 0) {
+    return nullptr;
+  }
+
+  std::shared_ptr<Face> loser;
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto iter = entries_.find(key);
+  if (iter != entries_.end()) {
+    // Another thread loaded the same face meanwhile. Keep the first one,
+    // and let ours go once the lock is released.
+    loser = std::move(face);
+    lru_.splice(lru_.begin(), lru_, iter->second.lru_iter);
+    return iter->second.face;
+  }
+
+  if (!IsMapped(font_path, file.get())) {
+    size_ += file->size();
+  }
+  lru_.emplace_front(key);
+  entries_[key] = {face, lru_.begin()};
+  Evict();
+  return face;
+}
+
+std::shared_ptr<MappedFile> FontFaceCache::FindMapping(
+    const AString& font_path) const {
+  auto iter = entries_.lower_bound(std::make_pair(font_path, LONG_MIN));
+  if (iter != entries_.end() && iter->first.first == font_path) {
+    return iter->second.face->file_;
+  }
+  return nullptr;
+}
+
+bool FontFaceCache::IsMapped(const AString& font_path,
+                             const MappedFile* file) const {
+  for (auto iter = entries_.lower_bound(std::make_pair(font_path, LONG_MIN));
+       iter != entries_.end() && iter->first.first == font_path; ++iter) {
+    if (iter->second.face->file_.get() == file) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FontFaceCache::Evict() {
+  auto iter = lru_.end();
+  while (size_ > max_size_ && iter != lru_.begin()) {
+    --iter;
+    auto entry = entries_.find(*iter);
+    if (entry->second.face.use_count() > 1) {
+      continue;
+    }
+    const AString font_path = entry->first.first;
+    std::shared_ptr<MappedFile> file = entry->second.face->file_;
+    entries_.erase(entry);
+    iter = lru_.erase(iter);
+    if (!IsMapped(font_path, file.get())) {
+      size_ -= file->size();
+    }
+  }
+}
+
+FT_Face FontFaceCache::Face::ft_face() {
+  // Most faces are only subsetted, which needs HarfBuzz alone, so the
+  // FreeType face is created on first use.
+  if (!is_ft_loaded_) {
+    is_ft_loaded_ = true;
+    std::lock_guard<std::mutex> lock(library_->mtx);
+    if (FT_New_Memory_Face(library_->ft_library.get(),
+                           reinterpret_cast<const FT_Byte*>(file_->data()),
+                           static_cast<FT_Long>(file_->size()), font_index_,
+                           &ft_face_)) {
+      ft_face_ = nullptr;
+    }
+  }
+  return ft_face_;
+}
+
+FontFaceCache::Face::~Face() {
+  if (hb_face_) {
+    hb_face_destroy(hb_face_);
+  }
+  if (ft_face_) {
+    std::lock_guard<std::mutex> lock(library_->mtx);
+    FT_Done_Face(ft_face_);
+  }
+}
+
+}  // namespace ass
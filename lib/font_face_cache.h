@@ -0,0 +1,109 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_FONTFACECACHE_H_
+#define ASSFONTS_FONTFACECACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <harfbuzz/hb.h>
+
+#include "ass_freetype.h"
+#include "ass_mmap.h"
+#include "ass_string.h"
+
+namespace ass {
+
+// Process-wide cache of parsed font faces shared by all subsetters of a
+// batch, so each font file is mapped and parsed only once. Faces are
+// handed out by reference count. Once the mapped files exceed max_size
+// bytes, the least recently used faces that are not in use are dropped.
+// Faces of a collection that share a mapping count its size once.
+class FontFaceCache {
+ public:
+  class Face;
+
+  FontFaceCache(const uintmax_t max_size);
+  ~FontFaceCache() = default;
+
+  FontFaceCache(const FontFaceCache&) = delete;
+  FontFaceCache& operator=(const FontFaceCache&) = delete;
+
+  std::shared_ptr<Face> Get(const AString& font_path, const long font_index);
+
+ private:
+  struct Library {
+    FTLibrary ft_library;
+    std::mutex mtx;
+  };
+
+  struct Entry {
+    std::shared_ptr<Face> face;
+    std::list<std::pair<AString, long>>::iterator lru_iter;
+  };
+
+  uintmax_t max_size_;
+  uintmax_t size_ = 0;
+  std::shared_ptr<Library> library_;
+  std::map<std::pair<AString, long>, Entry> entries_;
+  std::list<std::pair<AString, long>> lru_;
+  std::mutex mtx_;
+
+  std::shared_ptr<MappedFile> FindMapping(const AString& font_path) const;
+  bool IsMapped(const AString& font_path, const MappedFile* file) const;
+  void Evict();
+};
+
+// HarfBuzz faces are safe to share between threads. FreeType faces are
+// not, so ft_face() must only be used while holding ft_mtx(). The FreeType
+// face is only created the first time ft_face() is called, and is nullptr
+// if FreeType cannot load the font.
+class FontFaceCache::Face {
+ public:
+  ~Face();
+
+  Face(const Face&) = delete;
+  Face& operator=(const Face&) = delete;
+
+  inline hb_face_t* hb_face() const { return hb_face_; }
+  FT_Face ft_face();
+  inline std::mutex& ft_mtx() { return ft_mtx_; }
+
+ private:
+  friend class FontFaceCache;
+
+  Face() = default;
+
+  std::shared_ptr<Library> library_;
+  std::shared_ptr<MappedFile> file_;
+  long font_index_ = 0;
+  hb_face_t* hb_face_ = nullptr;
+  FT_Face ft_face_ = nullptr;
+  bool is_ft_loaded_ = false;
+  std::mutex ft_mtx_;
+};
+
+}  // namespace ass
+
+#endif
@@ -19,12 +19,15 @@
 
 #include "font_parser.h"
 
+#include <algorithm>
+#include <atomic>
 #include <exception>
 #include <fstream>
+#include <map>
 #include <future>
-#include <regex>
-#include <sstream>
+#include <mutex>
 #include <thread>
+#include <unordered_set>
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,7 +39,6 @@ extern "C" {
 #endif
 
 #include FT_MODULE_H
-#include FT_TYPE1_TABLES_H
 #include FT_SFNT_NAMES_H
 #include FT_TRUETYPE_IDS_H
 #include FT_TRUETYPE_TABLES_H
@@ -56,13 +58,15 @@ extern "C" {
 #endif
 
 #include "ass_freetype.h"
-
-#ifdef _WIN32
-constexpr int MAX_TCHAR = 128;
-#endif
+#include "bounded_queue.h"
+#include "dir_walker.h"
+#include "font_database.h"
 
 namespace fs = ghc::filesystem;
 
+constexpr size_t PATH_QUEUE_SIZE = 4096;
+constexpr size_t RESULT_QUEUE_SIZE = 256;
+
 static std::vector<AString> DEFAULT_FONT_PATHS = []() {
   std::vector<AString> paths;
 
@@ -122,27 +126,103 @@ void FontParser::LoadFonts(std::vector<AString> fonts_dirs, bool with_default) {
                       DEFAULT_FONT_PATHS.end());
   }
 
-  for (const auto& dir : fonts_dirs) {
-    auto fonts_path = FindFileInDir(dir, _ST(".+\\.(ttf|otf|ttc|otc)$"));
-    fonts_path_.insert(fonts_path_.end(), fonts_path.begin(), fonts_path.end());
-    logger_->Info(_ST("Found {} font files in \"{}\". Parsing font files."),
-                  fonts_path.size(), dir);
-  }
+  struct ParseResult {
+    AString font_path;
+    FontState state = FONT_ADDED;
+    std::unordered_multimap<AString, FontInfo> font_list;
+  };
+
+  const unsigned int num_threads = std::thread::hardware_concurrency() + 1;
+  BoundedQueue<AString> path_queue(PATH_QUEUE_SIZE);
+  BoundedQueue<ParseResult> result_queue(RESULT_QUEUE_SIZE);
+
+  // Walk, parse and merge run as a pipeline, so parsing starts with the
+  // first file found and each result is merged as soon as it is ready.
+  std::exception_ptr parse_error;
+  std::mutex parse_error_mtx;
+
+  std::thread walk_thread([&]() {
+    // Anything thrown while walking is rethrown once the pipeline drained
+    try {
+      ThreadPool walk_pool(num_threads);
+      DirWalker walker(walk_pool,
+                       {_ST(".ttf"), _ST(".otf"), _ST(".ttc"), _ST(".otc")});
+
+      for (const auto& dir : fonts_dirs) {
+        std::atomic<size_t> num_found(0);
+
+        walker.Walk(
+            dir,
+            [&](const AString& font_path) {
+              ++num_found;
+              path_queue.Push(font_path);
+            },
+            [&](const AString& dir_path) {
+              logger_->Warn(_ST("Failed in searching font files in \"{}\"."),
+                            dir_path);
+            });
+
+        logger_->Info(
+            _ST("Found {} font files in \"{}\". Parsing font files."),
+            num_found.load(), dir);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(parse_error_mtx);
+      if (!parse_error) {
+        parse_error = std::current_exception();
+      }
+    }
 
-  font_list_.reserve(fonts_path_.size());
+    path_queue.Close();
+  });
+
+  ThreadPool parse_pool(num_threads);
+  std::atomic<unsigned int> num_parsers(num_threads);
+
+  for (unsigned int idx = 0; idx < num_threads; ++idx) {
+    parse_pool.enqueue([&]() {
+      // The result queue must be closed however the parser ends, or the
+      // merge loop below would wait forever. A failure stops the walk and
+      // is rethrown once the pipeline has drained.
+      try {
+        AString font_path;
+        while (path_queue.Pop(font_path)) {
+          ParseResult result;
+          result.font_path = font_path;
+          result.font_list = GetFontInfo(font_path, result.state);
+          result_queue.Push(std::move(result));
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(parse_error_mtx);
+        if (!parse_error) {
+          parse_error = std::current_exception();
+        }
+        path_queue.Close();
+      }
+      if (--num_parsers == 0) {
+        result_queue.Close();
+      }
+    });
+  }
 
-  ThreadPool pool(std::thread::hardware_concurrency() + 1);
-  std::vector<std::future<std::unordered_multimap<AString, FontInfo>>> results;
+  std::vector<FontState> states;
+  ParseResult result;
 
-  for (const AString& font_path : fonts_path_) {
-    results.emplace_back(
-        pool.enqueue([this, font_path]() { return GetFontInfo(font_path); }));
+  while (result_queue.Pop(result)) {
+    font_list_.insert(result.font_list.begin(), result.font_list.end());
+    fonts_path_.emplace_back(std::move(result.font_path));
+    states.emplace_back(result.state);
   }
 
-  for (auto&& result : results) {
-    auto font_list = result.get();
-    font_list_.insert(font_list.begin(), font_list.end());
+  walk_thread.join();
+
+  if (parse_error) {
+    std::rethrow_exception(parse_error);
   }
+
+  IndexFontList();
+
+  LogChanges(states);
 }
 
 void FontParser::SaveDB(const AString& db_path) {
@@ -157,33 +237,33 @@ void FontParser::SaveDB(const AString& db_path) {
                   file_path.native());
   }
 
-  std::ofstream db_file(file_path.native());
+  // The old database may still be mapped, so write a new file and replace it.
+  fs::path tmp_path(file_path.native() + _ST(".tmp"));
+  std::ofstream db_file(tmp_path.native(), std::ios::binary);
   if (!db_file.is_open()) {
     logger_->Warn(_ST("\"{}\" is inaccessible."), file_path.native());
     return;
   }
 
-  nlohmann::ordered_json json;
+  const std::string image = FontDatabase::Serialize(font_list_);
+  db_file.write(image.data(), image.size());
+  db_file.close();
 
-  for (const auto& font : font_list_) {
-    nlohmann::ordered_json js_font;
-    js_font["families"] = font.second.families;
-    js_font["fullnames"] = font.second.fullnames;
-    js_font["psnames"] = font.second.psnames;
-    js_font["weight"] = font.second.weight;
-    js_font["slant"] = font.second.slant;
-#ifdef _WIN32
-    js_font["path"] = WideToU8(font.first);
-#else
-    js_font["path"] = font.first;
-#endif
-    js_font["index"] = font.second.index;
-    js_font["last_write_time"] = font.second.last_write_time;
-
-    json.emplace_back(js_font);
+  std::error_code ec;
+  if (db_file.fail()) {
+    fs::remove(tmp_path, ec);
+    logger_->Warn(_ST("\"{}\" is inaccessible."), file_path.native());
+    return;
   }
 
-  db_file << json.dump(4);
+  font_db_.reset();
+
+  fs::rename(tmp_path, file_path, ec);
+  if (ec) {
+    fs::remove(tmp_path, ec);
+    logger_->Warn(_ST("\"{}\" is inaccessible."), file_path.native());
+    return;
+  }
 
   logger_->Info(_ST("Fonts database has been saved in \"{}\""),
                 file_path.native());
@@ -192,13 +272,44 @@ void FontParser::SaveDB(const AString& db_path) {
 void FontParser::LoadDB(const AString& db_path) {
   fs::path file_path(db_path);
 
-  std::ifstream db_file(file_path.native());
+  std::ifstream db_file(file_path.native(), std::ios::binary);
   if (!db_file.is_open()) {
     logger_->Warn(_ST("Fonts database \"{}\" doesn't exists."),
                   file_path.native());
     return;
   }
 
+  char magic[8] = {};
+  db_file.read(magic, sizeof(magic));
+
+  if (FontDatabase::IsBinary(magic, static_cast<size_t>(db_file.gcount()))) {
+    db_file.close();
+
+    auto font_db = std::make_shared<FontDatabase>();
+    if (!font_db->Open(file_path.native())) {
+      logger_->Warn(_ST("Cannot load fonts database: \"{}\""),
+                    file_path.native());
+      return;
+    }
+    font_db_ = std::move(font_db);
+
+  } else {
+    db_file.clear();
+    db_file.seekg(0);
+
+    if (!LoadJsonDB(db_file)) {
+      logger_->Warn(_ST("Cannot load fonts database: \"{}\""),
+                    file_path.native());
+      return;
+    }
+  }
+
+  logger_->Info(_ST("Load fonts database \"{}\""), file_path.native());
+}
+
+bool FontParser::LoadJsonDB(std::ifstream& db_file) {
+  std::unordered_multimap<AString, FontInfo> font_list;
+
   try {
     nlohmann::json json;
     db_file >> json;
@@ -216,74 +327,190 @@ void FontParser::LoadDB(const AString& db_path) {
       font.first = js_font["path"];
 #endif
       font.second.index = js_font["index"];
-      font.second.last_write_time = js_font["last_write_time"];
-      font_list_in_db_.emplace(font);
+      font_list.emplace(font);
     }
   } catch (const nlohmann::json::exception&) {
-    logger_->Warn(_ST("Cannot load fonts database: \"{}\""),
-                  file_path.native());
-    font_list_in_db_.clear();
-    return;
+    return false;
   }
 
-  logger_->Info(_ST("Load fonts database \"{}\""), file_path.native());
+  auto font_db = std::make_shared<FontDatabase>();
+  if (!font_db->Assign(FontDatabase::Serialize(font_list))) {
+    return false;
+  }
+  font_db_ = std::move(font_db);
+
+  return true;
 }
 
 void FontParser::clean_font_list() {
+  font_index_.clear();
   font_list_.clear();
 }
 
-std::vector<AString> FontParser::FindFileInDir(const AString& dir,
-                                               const AString& pattern) {
-  std::vector<AString> res;
-  const std::basic_regex<AChar> r(pattern, std::regex::icase);
-  const fs::path dir_path(dir);
+void FontParser::IndexFontList() {
+  font_index_.clear();
 
-  try {
-    const fs::recursive_directory_iterator iter(dir_path);
-
-    for (const auto& dir_entry : iter) {
-      if (std::regex_match(dir_entry.path().native(), r)) {
-        res.emplace_back(dir_entry.path().native());
+  for (const auto& font : font_list_) {
+    auto add_names = [&](const std::vector<std::string>& names) {
+      for (const auto& name : names) {
+        auto& entries = font_index_[name];
+        if (entries.empty() || entries.back() != &font) {
+          entries.emplace_back(&font);
+        }
       }
-    }
+    };
 
-  } catch (const fs::filesystem_error& e) {
-    logger_->Warn("Failed in searching font files. Error code: {}", e.what());
-    res.clear();
-    return res;
+    add_names(font.second.families);
+    add_names(font.second.fullnames);
+    add_names(font.second.psnames);
   }
 
-  return res;
+  // Fonts are merged in completion order, so sort the candidates to keep
+  // font matching independent of it.
+  for (auto& entries : font_index_) {
+    std::sort(entries.second.begin(), entries.second.end(),
+              [](const FontEntry* a, const FontEntry* b) {
+                return (a->first < b->first) ||
+                       (a->first == b->first &&
+                        a->second.index < b->second.index);
+              });
+  }
+}
+
+std::vector<FontParser::FontMatch> FontParser::MatchFontList(
+    const std::string& fontname) const {
+  std::vector<FontMatch> matches;
+  const std::string name = ToLower(fontname);
+
+  auto iter = font_index_.find(name);
+  if (iter == font_index_.end()) {
+    return matches;
+  }
+
+  for (const auto* font : iter->second) {
+    FontMatch match;
+    match.path = font->first;
+    match.index = font->second.index;
+    match.weight = font->second.weight;
+    match.slant = font->second.slant;
+    match.is_family = std::find(font->second.families.begin(),
+                                font->second.families.end(),
+                                name) != font->second.families.end();
+    match.has_coverage = font->second.has_coverage;
+    match.coverage = font->second.coverage.data();
+    match.coverage_size = font->second.coverage.size();
+    matches.emplace_back(match);
+  }
+
+  return matches;
+}
+
+std::vector<FontParser::FontMatch> FontParser::MatchFontDB(
+    const std::string& fontname) const {
+  std::vector<FontMatch> matches;
+
+  if (!font_db_) {
+    return matches;
+  }
+
+  std::map<uint32_t, bool> faces;
+  for (const auto& name : font_db_->FindName(ToLower(fontname))) {
+    faces[name.first] =
+        faces[name.first] || name.second == FontDatabase::FAMILY;
+  }
+
+  for (const auto& face : faces) {
+    FontMatch match;
+    match.path = font_db_->get_path(face.first);
+    match.index = font_db_->get_index(face.first);
+    match.weight = font_db_->get_weight(face.first);
+    match.slant = font_db_->get_slant(face.first);
+    match.is_family = face.second;
+    match.has_coverage = font_db_->get_coverage(face.first, match.coverage,
+                                                match.coverage_size);
+    matches.emplace_back(match);
+  }
+
+  return matches;
 }
 
 std::unordered_multimap<AString, FontParser::FontInfo> FontParser::GetFontInfo(
-    const AString& font_path) {
-  std::string last_write_time;
-  std::vector<std::unordered_multimap<AString, FontInfo>::iterator> iters_found;
+    const AString& font_path, FontState& state) {
+  FileFingerprint fingerprint;
+  std::vector<FontInfo> fonts_found;
 
-  if (ExistInDB(font_path, last_write_time, iters_found)) {
-    return GetFontInfoFromDB(font_path, last_write_time, iters_found);
+  if (ExistInDB(font_path, fingerprint, fonts_found)) {
+    state = FONT_UNCHANGED;
+    return GetFontInfoFromDB(font_path, fonts_found);
   }
+  state = fonts_found.empty() ? FONT_ADDED : FONT_CHANGED;
 
   std::unordered_multimap<AString, FontInfo> font_list;
 
+  // The file is mapped once and every face of a collection is read from
+  // the same mapping.
+  MappedFile font_file;
+  if (!font_file.Open(font_path)) {
+    logger_->Warn(_ST("\"{}\" cannot be opened."), font_path);
+    return font_list;
+  }
+
   FTLibrary ft_library;
-  FT_Init_FreeType(&ft_library.get());
+  auto get_ft_library = [&ft_library]() -> FT_Library& {
+    if (ft_library.get() == nullptr) {
+      FT_Init_FreeType(&ft_library.get());
+    }
+    return ft_library.get();
+  };
 
-  FT_StreamRec ft_stream = {};
-  FT_Open_Args open_args = {};
-  NewOpenArgs(font_path, ft_stream, open_args);
+  SfntReader sfnt;
+  const bool is_sfnt = sfnt.Open(font_file.data(), font_file.size());
 
-  FTFace ft_face;
-  if (!OpenFontFace(ft_library.get(), open_args, ft_face.get(), font_path)) {
-    return font_list;
+  long n_face = 0;
+  if (is_sfnt) {
+    n_face = sfnt.num_faces();
+  } else {
+    FTFace ft_face;
+    if (FT_New_Memory_Face(get_ft_library(),
+                           reinterpret_cast<const FT_Byte*>(font_file.data()),
+                           static_cast<FT_Long>(font_file.size()), -1,
+                           &ft_face.get())) {
+      ft_face.get() = nullptr;
+      logger_->Warn(_ST("\"{}\" cannot be opened."), font_path);
+      return font_list;
+    }
+    n_face = ft_face.get()->num_faces;
   }
 
-  const long n_face = ft_face.get()->num_faces;
   for (long face_idx = 0; face_idx < n_face; ++face_idx) {
-    GetFontInfoFromFace(ft_library.get(), ft_face.get(), open_args, face_idx,
-                        font_list, font_path, last_write_time);
+    FontInfo font_info;
+
+    // Faces are read from their tables directly. FreeType is only used for
+    // what the table reader does not handle.
+    if (!(is_sfnt && GetFontInfoFromSfnt(sfnt, face_idx, font_info)) &&
+        !GetFontInfoFromFace(get_ft_library(), font_file, face_idx,
+                             font_info)) {
+      continue;
+    }
+
+    if (font_info.families.empty() && font_info.fullnames.empty() &&
+        font_info.psnames.empty()) {
+      continue;
+    }
+
+    if (font_info.slant < 0 || font_info.slant > 110) {
+      font_info.slant = 0;
+    }
+
+    if (font_info.weight < 100 || font_info.weight > 900) {
+      font_info.weight = 400;
+    }
+
+    font_info.index = face_idx;
+    font_info.fingerprint = fingerprint;
+    font_info.has_coverage = true;
+
+    font_list.emplace(font_path, std::move(font_info));
   }
 
   if (font_list.empty()) {
@@ -294,98 +521,88 @@ std::unordered_multimap<AString, FontParser::FontInfo> FontParser::GetFontInfo(
 }
 
 std::unordered_multimap<AString, FontParser::FontInfo>
-FontParser::GetFontInfoFromDB(
-    const AString& font_path, const std::string& last_write_time,
-    const std::vector<std::unordered_multimap<AString, FontInfo>::iterator>&
-        iters_found) {
+FontParser::GetFontInfoFromDB(const AString& font_path,
+                              const std::vector<FontInfo>& fonts_found) {
   std::unordered_multimap<AString, FontInfo> font_list;
 
-  for (const auto& iter : iters_found) {
-    font_list.emplace(*iter);
+  for (const auto& font : fonts_found) {
+    font_list.emplace(font_path, font);
   }
 
   return font_list;
 }
 
-bool FontParser::OpenFontFace(FT_Library& ft_library,
-                              const FT_Open_Args& open_args, FT_Face& ft_face,
-                              const AString& font_path) {
-  if (FT_Open_Face(ft_library, &open_args, -1, &ft_face)) {
-    logger_->Warn(_ST("\"{}\" cannot be opened."), font_path);
-    return false;
-  }
-  return true;
-}
-
-void FontParser::GetFontInfoFromFace(
-    FT_Library& ft_library, FT_Face& ft_face, const FT_Open_Args& open_args,
-    const long face_idx, std::unordered_multimap<AString, FontInfo>& font_list,
-    const AString& font_path, const std::string& last_write_time) {
-  std::pair<AString, FontInfo> font_info;
-  std::vector<std::string> families;
-  std::vector<std::string> fullnames;
-  std::vector<std::string> psnames;
-
-  if (FT_Open_Face(ft_library, &open_args, face_idx, &ft_face)) {
-    return;
-  }
+bool FontParser::GetFontInfoFromSfnt(const SfntReader& sfnt,
+                                     const long face_idx,
+                                     FontInfo& font_info) {
+  SfntReader::Style style;
+  std::vector<SfntReader::Name> names;
 
-  if (FT_Has_PS_Glyph_Names(ft_face)) {
-    PS_FontInfo afont_info = nullptr;
-    if (!FT_Get_PS_Font_Info(ft_face, afont_info)) {
-      families.emplace_back(std::string(afont_info->family_name));
-      fullnames.emplace_back(std::string(afont_info->full_name));
-    }
-  }
-
-  const unsigned int num_names = FT_Get_Sfnt_Name_Count(ft_face);
-  for (unsigned int name_idx = 0; name_idx < num_names; ++name_idx) {
-    ParseFontName(ft_face, name_idx, families, fullnames, psnames);
+  if (!sfnt.HasRequiredTables(face_idx) || !sfnt.GetStyle(face_idx, style) ||
+      !sfnt.GetNames(face_idx, names) ||
+      !sfnt.GetCoverage(face_idx, font_info.coverage)) {
+    return false;
   }
 
-  if (families.empty() && fullnames.empty() && psnames.empty()) {
-    return;
+  for (const auto& name : names) {
+    ParseFontName(name, font_info.families, font_info.fullnames,
+                  font_info.psnames);
   }
 
-  font_info.second.slant =
-      110 * !!(ft_face->style_flags & FT_STYLE_FLAG_ITALIC);
+  font_info.slant = 110 * style.is_italic;
+  font_info.weight = AssFaceGetWeight(
+      style.has_os2 ? style.weight_class : 0, style.is_bold);
 
-  font_info.second.weight = AssFaceGetWeight(ft_face);
+  return true;
+}
 
-  if (font_info.second.slant < 0 || font_info.second.slant > 110) {
-    font_info.second.slant = 0;
+bool FontParser::GetFontInfoFromFace(FT_Library& ft_library,
+                                     const MappedFile& font_file,
+                                     const long face_idx,
+                                     FontInfo& font_info) {
+  FTFace ft_face;
+  if (FT_New_Memory_Face(ft_library,
+                         reinterpret_cast<const FT_Byte*>(font_file.data()),
+                         static_cast<FT_Long>(font_file.size()), face_idx,
+                         &ft_face.get())) {
+    ft_face.get() = nullptr;
+    return false;
   }
 
-  if (font_info.second.weight < 100 || font_info.second.weight > 900) {
-    font_info.second.weight = 400;
+  const unsigned int num_names = FT_Get_Sfnt_Name_Count(ft_face.get());
+  for (unsigned int name_idx = 0; name_idx < num_names; ++name_idx) {
+    FT_SfntName ft_name;
+    if (FT_Get_Sfnt_Name(ft_face.get(), name_idx, &ft_name)) {
+      continue;
+    }
+    SfntReader::Name name = {
+        ft_name.platform_id, ft_name.encoding_id,
+        ft_name.language_id, ft_name.name_id,
+        reinterpret_cast<const char*>(ft_name.string),
+        static_cast<uint16_t>(ft_name.string_len)};
+    ParseFontName(name, font_info.families, font_info.fullnames,
+                  font_info.psnames);
   }
 
-  font_info.second.families = families;
-  font_info.second.fullnames = fullnames;
-  font_info.second.psnames = psnames;
-
-  font_info.first = font_path;
+  const bool is_bold = ft_face.get()->style_flags & FT_STYLE_FLAG_BOLD;
+  TT_OS2* os2 =
+      static_cast<TT_OS2*>(FT_Get_Sfnt_Table(ft_face.get(), FT_SFNT_OS2));
 
-  font_info.second.index = face_idx;
+  font_info.slant =
+      110 * !!(ft_face.get()->style_flags & FT_STYLE_FLAG_ITALIC);
+  font_info.weight = AssFaceGetWeight(os2 ? os2->usWeightClass : 0, is_bold);
+  font_info.coverage = GetCoverage(ft_face.get());
 
-  font_info.second.last_write_time = last_write_time;
-
-  font_list.emplace(font_info);
+  return true;
 }
 
-void FontParser::ParseFontName(const FT_Face& ft_face,
-                               const unsigned int name_idx,
+void FontParser::ParseFontName(const SfntReader::Name& name,
                                std::vector<std::string>& families,
                                std::vector<std::string>& fullnames,
                                std::vector<std::string>& psnames) {
-  FT_SfntName name;
   std::string wbuf;
   std::string buf;
 
-  if (FT_Get_Sfnt_Name(ft_face, name_idx, &name)) {
-    return;
-  }
-
   if (name.name_id != TT_NAME_ID_FULL_NAME &&
       name.name_id != TT_NAME_ID_FONT_FAMILY &&
       name.name_id != TT_NAME_ID_PS_NAME) {
@@ -396,7 +613,7 @@ void FontParser::ParseFontName(const FT_Face& ft_face,
     return;
   }
 
-  wbuf = std::string(reinterpret_cast<char*>(name.string), name.string_len);
+  wbuf = std::string(name.string, name.string_len);
 
   switch (name.encoding_id) {
     case TT_MS_ID_PRC: {
@@ -407,7 +624,7 @@ void FontParser::ParseFontName(const FT_Face& ft_face,
         }
       }
       if (!IconvConvert(wbufn, buf, "GB2312", "UTF-8")) {
-        if (!IconvConvert(wbuf, buf, "UTF-16BE", "UTF-8")) {
+        if (!U16BEToU8(wbuf, buf)) {
           return;
         }
       }
@@ -422,7 +639,7 @@ void FontParser::ParseFontName(const FT_Face& ft_face,
         }
       }
       if (!IconvConvert(wbufn, buf, "BIG-5", "UTF-8")) {
-        if (!IconvConvert(wbuf, buf, "UTF-16BE", "UTF-8")) {
+        if (!U16BEToU8(wbuf, buf)) {
           return;
         }
       }
@@ -430,7 +647,7 @@ void FontParser::ParseFontName(const FT_Face& ft_face,
     }
 
     default:
-      if (!IconvConvert(wbuf, buf, "UTF-16BE", "UTF-8")) {
+      if (!U16BEToU8(wbuf, buf)) {
         return;
       }
       break;
@@ -479,7 +696,26 @@ void FontParser::ParseFontName(const FT_Face& ft_face,
   }
 }
 
-int FontParser::AssFaceGetWeight(const FT_Face& face) {
+FontParser::CodepointRanges FontParser::GetCoverage(const FT_Face& ft_face) {
+  CodepointRanges coverage;
+  FT_UInt glyph_idx = 0;
+  FT_ULong codepoint = FT_Get_First_Char(ft_face, &glyph_idx);
+
+  while (glyph_idx != 0) {
+    const auto cp = static_cast<uint32_t>(codepoint);
+    if (!coverage.empty() && coverage.back().last + 1 == cp) {
+      coverage.back().last = cp;
+    } else {
+      coverage.push_back({cp, cp});
+    }
+    codepoint = FT_Get_Next_Char(ft_face, codepoint, &glyph_idx);
+  }
+
+  return coverage;
+}
+
+int FontParser::AssFaceGetWeight(const FT_UShort os2Weight,
+                                 const bool is_bold) {
   /*
  * Copyright (C) 2006 Evgeniy Stepanov <eugeni.stepanov@gmail.com>
  *
@@ -498,11 +734,9 @@ int FontParser::AssFaceGetWeight(const FT_Face& face) {
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-  TT_OS2* os2 = static_cast<TT_OS2*>(FT_Get_Sfnt_Table(face, FT_SFNT_OS2));
-  FT_UShort os2Weight = os2 ? os2->usWeightClass : 0;
   switch (os2Weight) {
     case 0:
-      return 300 * !!(face->style_flags & FT_STYLE_FLAG_BOLD) + 400;
+      return 300 * is_bold + 400;
     case 1:
       return 100;
     case 2:
@@ -526,92 +760,114 @@ int FontParser::AssFaceGetWeight(const FT_Face& face) {
   }
 }
 
-bool FontParser::ExistInDB(
-    const AString& font_path, std::string& last_write_time,
-    std::vector<std::unordered_multimap<AString, FontInfo>::iterator>&
-        iters_found) {
-  last_write_time = GetLastWriteTime(font_path);
-
-  if (last_write_time.empty()) {
+bool FontParser::ExistInDB(const AString& font_path,
+                           FileFingerprint& fingerprint,
+                           std::vector<FontInfo>& fonts_found) {
+  if (!GetFingerprint(font_path, fingerprint) || !font_db_) {
     return false;
   }
 
-  auto iter_pair = font_list_in_db_.equal_range(font_path);
-  for (auto iter = iter_pair.first; iter != iter_pair.second; ++iter) {
-    iters_found.emplace_back(iter);
-  }
+  fonts_found = font_db_->FindPath(font_path);
 
-  if (iters_found.empty()) {
+  if (fonts_found.empty()) {
     return false;
   }
 
-  if (iters_found[0]->second.last_write_time == last_write_time) {
+  // Entries migrated from the JSON database carry no fingerprint or
+  // coverage and are parsed again so both get recorded.
+  if (fonts_found[0].fingerprint == fingerprint &&
+      fonts_found[0].has_coverage) {
     return true;
   } else {
     return false;
   }
 }
 
-std::string FontParser::GetLastWriteTime(const AString& font_path) {
+bool FontParser::GetFingerprint(const AString& font_path,
+                                FileFingerprint& fingerprint) {
 #ifdef _WIN32
-  FILETIME file_time;
-  SYSTEMTIME system_time;
   HANDLE file_handle =
       CreateFileW(font_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
                   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 
   if (file_handle == INVALID_HANDLE_VALUE) {
-    return std::string();
+    return false;
   }
 
-  TCHAR date[MAX_TCHAR], time[MAX_TCHAR];
-
-  if (!GetFileTime(file_handle, NULL, NULL, &file_time)) {
+  BY_HANDLE_FILE_INFORMATION info;
+  if (!GetFileInformationByHandle(file_handle, &info)) {
     CloseHandle(file_handle);
-    return std::string();
+    return false;
   }
 
-  if (!FileTimeToSystemTime(&file_time, &system_time)) {
-    CloseHandle(file_handle);
-    return std::string();
-  }
+  CloseHandle(file_handle);
 
-  if (!GetDateFormat(LOCALE_SYSTEM_DEFAULT, NULL, &system_time,
-                     "yyyy'-'MM'-'dd", date, MAX_TCHAR)) {
-    CloseHandle(file_handle);
-    return std::string();
-  }
+  fingerprint.device = info.dwVolumeSerialNumber;
+  fingerprint.inode = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) |
+                      info.nFileIndexLow;
+  fingerprint.size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) |
+                     info.nFileSizeLow;
+  // FILETIME counts 100-nanosecond intervals.
+  fingerprint.mtime_ns =
+      static_cast<int64_t>(
+          (static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) |
+          info.ftLastWriteTime.dwLowDateTime) *
+      100;
+  return true;
+#else
+  struct stat buffer;
 
-  if (!GetTimeFormat(LOCALE_SYSTEM_DEFAULT, NULL, &system_time, "HH':'mm':'ss",
-                     time, MAX_TCHAR)) {
-    CloseHandle(file_handle);
-    return std::string();
+  if (stat(font_path.c_str(), &buffer)) {
+    return false;
   }
 
-  CloseHandle(file_handle);
-  return "UTC " + std::string(date) + " " + std::string(time);
+  fingerprint.device = static_cast<uint64_t>(buffer.st_dev);
+  fingerprint.inode = static_cast<uint64_t>(buffer.st_ino);
+  fingerprint.size = static_cast<uint64_t>(buffer.st_size);
+#ifdef __APPLE__
+  fingerprint.mtime_ns =
+      static_cast<int64_t>(buffer.st_mtimespec.tv_sec) * 1000000000 +
+      buffer.st_mtimespec.tv_nsec;
 #else
-  auto buffer = std::unique_ptr<struct stat>(new struct stat);
+  fingerprint.mtime_ns =
+      static_cast<int64_t>(buffer.st_mtim.tv_sec) * 1000000000 +
+      buffer.st_mtim.tv_nsec;
+#endif
+  return true;
+#endif
+}
 
-  if (stat(font_path.c_str(), buffer.get())) {
-    return std::string();
+void FontParser::LogChanges(const std::vector<FontState>& states) {
+  if (!font_db_) {
+    return;
   }
 
-  std::stringstream ss;
-
-  auto gmt_time = std::gmtime(&buffer->st_mtime);
-  if (gmt_time == nullptr) {
-    return std::string();
+  size_t num_added = 0;
+  size_t num_changed = 0;
+  for (const auto& state : states) {
+    if (state == FONT_ADDED) {
+      ++num_added;
+    } else if (state == FONT_CHANGED) {
+      ++num_changed;
+    }
   }
 
-  try {
-    ss << std::put_time(gmt_time, "UTC %Y-%m-%d %H:%M:%S");
-  } catch (const std::exception&) {
-    return std::string();
+  // Files kept in the database but not found any more are dropped from it.
+  std::unordered_set<AString> paths(fonts_path_.begin(), fonts_path_.end());
+  size_t num_removed = 0;
+  AString last_path;
+  for (uint32_t face = 0; face < font_db_->size(); ++face) {
+    AString path = font_db_->get_path(face);
+    if (path != last_path && paths.find(path) == paths.end()) {
+      ++num_removed;
+    }
+    last_path = std::move(path);
   }
 
-  return ss.str();
-#endif
+  logger_->Info(
+      "Fonts database: {} added, {} changed, {} removed, {} unchanged.",
+      num_added, num_changed, num_removed,
+      states.size() - num_added - num_changed);
 }
 
 }  // namespace ass
\ No newline at end of file
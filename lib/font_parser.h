@@ -20,9 +20,12 @@
 #ifndef ASSFONTS_FONTPARSER_H_
 #define ASSFONTS_FONTPARSER_H_
 
+#include <cstdint>
+#include <fstream>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #ifdef __cplusplus
@@ -35,10 +38,14 @@ extern "C" {
 #endif
 
 #include "ass_logger.h"
+#include "ass_mmap.h"
 #include "ass_string.h"
+#include "sfnt_reader.h"
 
 namespace ass {
 
+class FontDatabase;
+
 class FontParser {
  public:
   FontParser(std::shared_ptr<Logger> logger) : logger_(logger){};
@@ -63,6 +70,25 @@ class FontParser {
   void clean_font_list();
 
  private:
+  // Sorted, non-overlapping inclusive ranges of mapped Unicode codepoints.
+  using CodepointRanges = std::vector<CodepointRange>;
+
+  // Identity of a font file on disk. Files whose fingerprint matches the
+  // database are not parsed again.
+  struct FileFingerprint {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+
+    bool operator==(const FileFingerprint& s) const {
+      return device == s.device && inode == s.inode && size == s.size &&
+             mtime_ns == s.mtime_ns;
+    }
+  };
+
+  enum FontState { FONT_ADDED = 0, FONT_CHANGED, FONT_UNCHANGED };
+
   struct FontInfo {
     std::vector<std::string> families;
     std::vector<std::string> fullnames;
@@ -70,42 +96,59 @@ class FontParser {
     int weight = 400;
     int slant = 0;
     long index = 0;
-    std::string last_write_time;
+    FileFingerprint fingerprint;
+    bool has_coverage = false;
+    CodepointRanges coverage;
   };
 
+  struct FontMatch {
+    AString path;
+    long index = 0;
+    int weight = 400;
+    int slant = 0;
+    bool is_family = false;
+    bool has_coverage = false;
+    // Refers to the ranges held by font_list_ or mapped from the fonts
+    // database, so it stays valid while the FontParser is unchanged.
+    const CodepointRange* coverage = nullptr;
+    size_t coverage_size = 0;
+  };
+
+  using FontEntry = std::pair<const AString, FontInfo>;
+
   std::shared_ptr<Logger> logger_;
 
   std::unordered_multimap<AString, FontInfo> font_list_;
-  std::unordered_multimap<AString, FontInfo> font_list_in_db_;
+  std::unordered_map<std::string, std::vector<const FontEntry*>> font_index_;
+  std::shared_ptr<FontDatabase> font_db_;
   std::vector<AString> fonts_path_;
 
-  std::vector<AString> FindFileInDir(const AString& dir,
-                                     const AString& pattern);
-
   std::unordered_multimap<AString, FontInfo> GetFontInfo(
-      const AString& font_path);
+      const AString& font_path, FontState& state);
   std::unordered_multimap<AString, FontInfo> GetFontInfoFromDB(
-      const AString& font_path, const std::string& last_write_time,
-      const std::vector<std::unordered_multimap<AString, FontInfo>::iterator>&
-          iters_found);
-  bool OpenFontFace(FT_Library& ft_library, const FT_Open_Args& open_args,
-                    FT_Face& ft_face, const AString& font_path);
-  void GetFontInfoFromFace(
-      FT_Library& ft_library, FT_Face& ft_face, const FT_Open_Args& open_args,
-      const long face_idx,
-      std::unordered_multimap<AString, FontInfo>& font_list,
-      const AString& font_path, const std::string& last_write_time);
-  void ParseFontName(const FT_Face& ft_face, const unsigned int name_idx,
+      const AString& font_path, const std::vector<FontInfo>& fonts_found);
+  bool GetFontInfoFromSfnt(const SfntReader& sfnt, const long face_idx,
+                           FontInfo& font_info);
+  bool GetFontInfoFromFace(FT_Library& ft_library, const MappedFile& font_file,
+                           const long face_idx, FontInfo& font_info);
+  void ParseFontName(const SfntReader::Name& name,
                      std::vector<std::string>& families,
                      std::vector<std::string>& fullnames,
                      std::vector<std::string>& psnames);
-  int AssFaceGetWeight(const FT_Face& face);
-  bool ExistInDB(
-      const AString& font_path, std::string& last_write_time,
-      std::vector<std::unordered_multimap<AString, FontInfo>::iterator>&
-          iters_found);
-  std::string GetLastWriteTime(const AString& font_path);
+  CodepointRanges GetCoverage(const FT_Face& ft_face);
+  int AssFaceGetWeight(const FT_UShort os2Weight, const bool is_bold);
+  bool ExistInDB(const AString& font_path, FileFingerprint& fingerprint,
+                 std::vector<FontInfo>& fonts_found);
+  bool GetFingerprint(const AString& font_path, FileFingerprint& fingerprint);
+  void LogChanges(const std::vector<FontState>& states);
+
+  bool LoadJsonDB(std::ifstream& db_file);
+
+  void IndexFontList();
+  std::vector<FontMatch> MatchFontList(const std::string& fontname) const;
+  std::vector<FontMatch> MatchFontDB(const std::string& fontname) const;
 
+  friend class FontDatabase;
   friend class FontSubsetter;
 };
 
@@ -23,6 +23,7 @@
 #include <climits>
 #include <exception>
 #include <fstream>
+#include <future>
 #include <random>
 
 #include <fmt/format.h>
@@ -34,15 +35,12 @@
 
 #include "ass_harfbuzz.h"
 #include "assfonts.h"
+#include "wait_all.h"
 
-static const std::u32string ADDITIONAL_CODEPOINTS = []() {
-  std::u32string codepoints;
-  for (char32_t ch = 0x0020; ch <= 0x007e; ++ch) {
-    codepoints.push_back(ch);
-  }
-  for (char32_t ch = 0xff01; ch <= 0xff5e; ++ch) {
-    codepoints.push_back(ch);
-  }
+static const ass::CodepointSet ADDITIONAL_CODEPOINTS = []() {
+  ass::CodepointSet codepoints;
+  codepoints.InsertRange(0x0020, 0x007e);
+  codepoints.InsertRange(0xff01, 0xff5e);
   return codepoints;
 }();
 
@@ -54,35 +52,55 @@ void FontSubsetter::SetSubfontDir(const AString& subfont_dir) {
   subfont_dir_ = subfont_dir;
 }
 
+void FontSubsetter::SetWriteSubfonts(const bool is_write_subfonts) {
+  is_write_subfonts_ = is_write_subfonts;
+}
+
+void FontSubsetter::SetSubsetCache(std::shared_ptr<SubsetCache> subset_cache) {
+  subset_cache_ = subset_cache;
+}
+
+void FontSubsetter::SetThreadPool(ThreadPool* pool) {
+  pool_ = pool;
+}
+
+void FontSubsetter::SetFontFaceCache(
+    std::shared_ptr<FontFaceCache> face_cache) {
+  face_cache_ = face_cache;
+}
+
 bool FontSubsetter::Run(const bool is_no_subset, const bool is_rename) {
+  if (!face_cache_) {
+    face_cache_ = std::make_shared<FontFaceCache>(UINTMAX_MAX);
+  }
   if (is_no_subset) {
     bool have_missing = false;
     FontSubsetInfo subfont_info;
+    auto font_checks = CheckFonts();
+    auto font_check = font_checks.begin();
     for (const auto& font_set : font_sets_) {
 #ifdef _WIN32
       AString fontname = U8ToWide(font_set.first.fontname);
 #else
       AString fontname(font_set.first.fontname);
 #endif
-      if (!FindFont(font_set, fp_.font_list_, subfont_info.font_path.path,
-                    subfont_info.font_path.index) &&
-          !FindFont(font_set, fp_.font_list_in_db_, subfont_info.font_path.path,
-                    subfont_info.font_path.index)) {
+      if (!font_check->is_found) {
         logger_->Warn(_ST("Missing the font: \"{}\" ({},{})"), fontname,
                       font_set.first.bold, font_set.first.italic);
         have_missing = true;
       } else {
+        subfont_info.font_path = font_check->font_path;
         logger_->Info(_ST("Found font: \"{}\" ({},{}) --> \"{}\"[{}]"),
                       fontname, font_set.first.bold, font_set.first.italic,
                       subfont_info.font_path.path,
                       subfont_info.font_path.index);
-        CheckGlyph(subfont_info.font_path.path, subfont_info.font_path.index,
-                   font_set.second, fontname, font_set.first.bold,
-                   font_set.first.italic);
+        LogGlyphCheck(*font_check, fontname, font_set.first.bold,
+                      font_set.first.italic);
       }
       subfont_info.fonts_desc.emplace_back(font_set.first);
       subfont_info.subfont_path = subfont_info.font_path.path;
       subfonts_info_.emplace_back(subfont_info);
+      ++font_check;
     }
     if (have_missing) {
       logger_->Error(_ST("Found missing fonts. Check warning info above."));
@@ -97,7 +115,7 @@ bool FontSubsetter::Run(const bool is_no_subset, const bool is_rename) {
     SetNewname();
   }
   fs::path dir_path(subfont_dir_);
-  if (!fs::exists(dir_path)) {
+  if (is_write_subfonts_ && !fs::exists(dir_path)) {
     logger_->Info(_ST("Create subset fonts directory: \"{}\""),
                   dir_path.native());
     try {
@@ -108,10 +126,23 @@ bool FontSubsetter::Run(const bool is_no_subset, const bool is_rename) {
       return false;
     }
   }
+  // Output names are picked up front so that parallel subsetting stays
+  // deterministic when two fonts share a file name.
+  std::set<AString> subfont_paths;
   for (auto& subset_font : subfonts_info_) {
-    if (!CreateSubfont(subset_font, is_rename)) {
+    subset_font.subfont_path =
+        GetSubfontPath(subset_font, is_rename, subfont_paths);
+  }
+  std::vector<char> is_created(subfonts_info_.size(), false);
+  RunTasks(subfonts_info_.size(), [&](const size_t idx) {
+    is_created[idx] = !subfonts_info_[idx].subfont_path.empty() &&
+                      CreateSubfont(subfonts_info_[idx], is_rename);
+  });
+  for (size_t idx = 0; idx < subfonts_info_.size(); ++idx) {
+    if (!is_created[idx]) {
       logger_->Error(_ST("Subset failed: \"{}\"[{}]"),
-                     subset_font.font_path.path, subset_font.font_path.index);
+                     subfonts_info_[idx].font_path.path,
+                     subfonts_info_[idx].font_path.index);
       return false;
     }
   }
@@ -129,140 +160,155 @@ void FontSubsetter::Clear() {
 }
 
 bool FontSubsetter::FindFont(
-    const std::pair<AssParser::FontDesc, std::unordered_set<char32_t>>&
-        font_set,
-    const std::unordered_multimap<AString, FontParser::FontInfo>& font_list,
-    AString& found_path, long& found_index) {
-  auto fontname = ToLower(font_set.first.fontname);
-  bool is_found = false;
-  unsigned int min_score = UINT_MAX;
-  unsigned int score = UINT_MAX;
-  AString tmp_path;
-  long tmp_index = 0;
-  unsigned int ttf_score = UINT_MAX;
-  AString ttf_path;
-  long ttf_index = 0;
-  unsigned int otf_score = UINT_MAX;
-  AString otf_path;
-  long otf_index = 0;
-  for (const auto& font : font_list) {
-    if (std::find(font.second.families.begin(), font.second.families.end(),
-                  fontname) != font.second.families.end()) {
-      if (ToLower(font.first.substr(font.first.size() - 4, 4)) == _ST(".otf") ||
-          ToLower(font.first.substr(font.first.size() - 4, 4)) == _ST(".otc")) {
-        continue;
-      }
-      score = 0;
-      score += std::abs(font_set.first.bold - font.second.weight);
-      score += std::abs(font_set.first.italic - font.second.slant);
-    } else if ((std::find(font.second.fullnames.begin(),
-                          font.second.fullnames.end(),
-                          fontname) != font.second.fullnames.end()) ||
-               (std::find(font.second.psnames.begin(),
-                          font.second.psnames.end(),
-                          fontname) != font.second.psnames.end())) {
-      if (ToLower(font.first.substr(font.first.size() - 4, 4)) == _ST(".otf") ||
-          ToLower(font.first.substr(font.first.size() - 4, 4)) == _ST(".otc")) {
-        continue;
-      }
-      score = 0;
-    }
-    if (score < min_score) {
-      min_score = score;
-      tmp_path = font.first;
-      tmp_index = font.second.index;
-    }
-    if (score == 0) {
-      found_path = tmp_path;
-      found_index = tmp_index;
-      is_found = true;
-      return is_found;
+    const std::pair<AssParser::FontDesc, CodepointSet>& font_set,
+    const std::vector<FontParser::FontMatch>& matches,
+    FontParser::FontMatch& found) {
+  // Candidates are ranked by style distance, then by the number of
+  // requested codepoints they lack. Faces with unknown coverage come after
+  // equally styled faces whose coverage is known.
+  using Score = std::pair<unsigned int, size_t>;
+  const Score no_match(UINT_MAX, SIZE_MAX);
+  Score ttf_score = no_match;
+  const FontParser::FontMatch* ttf_match = nullptr;
+  Score otf_score = no_match;
+  const FontParser::FontMatch* otf_match = nullptr;
+  for (const auto& match : matches) {
+    Score score(0, 0);
+    if (match.is_family) {
+      score.first += std::abs(font_set.first.bold - match.weight);
+      score.first += std::abs(font_set.first.italic - match.slant);
     }
-  }
-  ttf_score = score;
-  ttf_path = tmp_path;
-  ttf_index = tmp_index;
-  min_score = UINT_MAX;
-  score = UINT_MAX;
-  tmp_path.clear();
-  tmp_index = 0;
-  for (const auto& font : font_list) {
-    if (std::find(font.second.families.begin(), font.second.families.end(),
-                  fontname) != font.second.families.end()) {
-      if (ToLower(font.first.substr(font.first.size() - 4, 4)) == _ST(".ttf") ||
-          ToLower(font.first.substr(font.first.size() - 4, 4)) == _ST(".ttc")) {
-        continue;
-      }
-      score = 0;
-      score += std::abs(font_set.first.bold - font.second.weight);
-      score += std::abs(font_set.first.italic - font.second.slant);
-    } else if ((std::find(font.second.fullnames.begin(),
-                          font.second.fullnames.end(),
-                          fontname) != font.second.fullnames.end()) ||
-               (std::find(font.second.psnames.begin(),
-                          font.second.psnames.end(),
-                          fontname) != font.second.psnames.end())) {
-      if (ToLower(font.first.substr(font.first.size() - 4, 4)) == _ST(".ttf") ||
-          ToLower(font.first.substr(font.first.size() - 4, 4)) == _ST(".ttc")) {
-        continue;
+    if (match.has_coverage) {
+      for (const auto& codepoint : font_set.second) {
+        if (codepoint &&
+            !HasCodepoint(match.coverage, match.coverage_size, codepoint)) {
+          ++score.second;
+        }
       }
-      score = 0;
+    } else {
+      score.second = SIZE_MAX - 1;
     }
-    if (score < min_score) {
-      min_score = score;
-      tmp_path = font.first;
-      tmp_index = font.second.index;
+    AString extension = match.path.size() < 4
+                            ? match.path
+                            : ToLower(match.path.substr(match.path.size() - 4));
+    if (extension == _ST(".otf") || extension == _ST(".otc")) {
+      if (score < otf_score) {
+        otf_score = score;
+        otf_match = &match;
+      }
+    } else if (score < ttf_score) {
+      ttf_score = score;
+      ttf_match = &match;
     }
-    if (score == 0) {
-      break;
+  }
+  if (ttf_match == nullptr && otf_match == nullptr) {
+    return false;
+  }
+  if (ttf_score <= otf_score) {
+    found = *ttf_match;
+  } else {
+    found = *otf_match;
+  }
+  return true;
+}
+
+bool FontSubsetter::HasCodepoint(const CodepointRange* coverage,
+                                 const size_t coverage_size,
+                                 const uint32_t codepoint) {
+  auto iter = std::upper_bound(
+      coverage, coverage + coverage_size, codepoint,
+      [](const uint32_t codepoint, const CodepointRange& range) {
+        return codepoint < range.first;
+      });
+  return iter != coverage && std::prev(iter)->last >= codepoint;
+}
+
+std::vector<FontSubsetter::FontCheck> FontSubsetter::CheckFonts() {
+  std::vector<FontCheck> font_checks(font_sets_.size());
+  std::vector<const CodepointSet*> codepoint_sets;
+  auto font_check = font_checks.begin();
+  for (const auto& font_set : font_sets_) {
+    FontParser::FontMatch match;
+    font_check->is_found =
+        FindFont(font_set, fp_.MatchFontList(font_set.first.fontname),
+                 match) ||
+        FindFont(font_set, fp_.MatchFontDB(font_set.first.fontname), match);
+    font_check->font_path.path = match.path;
+    font_check->font_path.index = match.index;
+    font_check->has_coverage = match.has_coverage;
+    font_check->coverage = match.coverage;
+    font_check->coverage_size = match.coverage_size;
+    codepoint_sets.emplace_back(&font_set.second);
+    ++font_check;
+  }
+  RunTasks(font_checks.size(), [&](const size_t idx) {
+    auto& check = font_checks[idx];
+    if (check.is_found) {
+      check.is_accessible =
+          CheckGlyph(check, *codepoint_sets[idx], check.missing_codepoints);
     }
+  });
+  return font_checks;
+}
+
+bool FontSubsetter::LogGlyphCheck(const FontCheck& font_check,
+                                  const AString& fontname, int bold,
+                                  int italic) {
+  if (!font_check.is_accessible) {
+    logger_->Error(_ST("\"{}\" is inaccessible."), font_check.font_path.path);
+    return false;
   }
-  otf_score = score;
-  otf_path = tmp_path;
-  otf_index = tmp_index;
-  if (ttf_score < UINT_MAX || otf_score < UINT_MAX) {
-    is_found = true;
-    if (ttf_score <= otf_score) {
-      found_path = ttf_path;
-      found_index = ttf_index;
-    } else {
-      found_path = otf_path;
-      found_index = otf_index;
+  if (!font_check.missing_codepoints.empty()) {
+    logger_->Warn(_ST("Missing codepoints for \"{}\" ({},{}): {:#06x}"),
+                  fontname, bold, italic,
+                  fmt::join(font_check.missing_codepoints, _ST("  ")));
+  }
+  return true;
+}
+
+void FontSubsetter::RunTasks(const size_t num_tasks,
+                             const std::function<void(const size_t)>& task) {
+  if (pool_ == nullptr || num_tasks < 2) {
+    for (size_t idx = 0; idx < num_tasks; ++idx) {
+      task(idx);
     }
+    return;
+  }
+  std::vector<std::future<void>> results;
+  for (size_t idx = 0; idx < num_tasks; ++idx) {
+    results.emplace_back(pool_->enqueue([&task, idx]() { task(idx); }));
   }
-  return is_found;
+  WaitAll(results);
 }
 
 bool FontSubsetter::set_subfonts_info() {
   bool have_missing = false;
+  auto font_checks = CheckFonts();
+  auto font_check = font_checks.begin();
   for (const auto& font_set : font_sets_) {
     FontPath font_path;
-    std::unordered_set<uint32_t> codepoint_set;
+    CodepointSet codepoint_set = font_set.second;
 #ifdef _WIN32
     AString fontname = U8ToWide(font_set.first.fontname);
 #else
     AString fontname(font_set.first.fontname);
 #endif
-    if (!FindFont(font_set, fp_.font_list_, font_path.path, font_path.index) &&
-        !FindFont(font_set, fp_.font_list_in_db_, font_path.path,
-                  font_path.index)) {
+    if (!font_check->is_found) {
       logger_->Warn(_ST("Missing the font: \"{}\" ({},{})"), fontname,
                     font_set.first.bold, font_set.first.italic);
       have_missing = true;
     } else {
+      font_path = font_check->font_path;
       logger_->Info(_ST("Found font: \"{}\" ({},{}) --> \"{}\"[{}]"), fontname,
                     font_set.first.bold, font_set.first.italic, font_path.path,
                     font_path.index);
-      if (!CheckGlyph(font_path.path, font_path.index, font_set.second,
-                      fontname, font_set.first.bold, font_set.first.italic)) {
+      if (!LogGlyphCheck(*font_check, fontname, font_set.first.bold,
+                         font_set.first.italic)) {
         return false;
       }
     }
-    for (const char32_t& wch : font_set.second) {
-      codepoint_set.insert(static_cast<uint32_t>(wch));
-    }
-    codepoint_set.insert(ADDITIONAL_CODEPOINTS.begin(),
-                         ADDITIONAL_CODEPOINTS.end());
+    ++font_check;
+    codepoint_set.Union(ADDITIONAL_CODEPOINTS);
     auto subfonts_info_iter =
         std::find_if(subfonts_info_.begin(), subfonts_info_.end(),
                      [&](const FontSubsetInfo& f) -> bool {
@@ -276,8 +322,7 @@ bool FontSubsetter::set_subfonts_info() {
       subfonts_info_.emplace_back(subfont_info);
     } else {
       (*subfonts_info_iter).fonts_desc.emplace_back(font_set.first);
-      (*subfonts_info_iter)
-          .codepoints.insert(codepoint_set.begin(), codepoint_set.end());
+      (*subfonts_info_iter).codepoints.Union(codepoint_set);
     }
   }
   if (have_missing) {
@@ -287,8 +332,9 @@ bool FontSubsetter::set_subfonts_info() {
   return true;
 }
 
-bool FontSubsetter::CreateSubfont(FontSubsetInfo& subset_font,
-                                  const bool is_rename) {
+AString FontSubsetter::GetSubfontPath(const FontSubsetInfo& subset_font,
+                                      const bool is_rename,
+                                      std::set<AString>& subfont_paths) {
   AString subfont_name_suffix;
   if (is_rename) {
 #ifdef _WIN32
@@ -300,7 +346,6 @@ bool FontSubsetter::CreateSubfont(FontSubsetInfo& subset_font,
     subfont_name_suffix = _ST("subset");
   }
   fs::path input_filepath(subset_font.font_path.path);
-  fs::path output_filepath;
 
   for (unsigned int i = 0; i < INT_MAX; ++i) {
     AString index = i == 0 ? _ST("") : _ST("_") + ToAString(i);
@@ -314,23 +359,34 @@ bool FontSubsetter::CreateSubfont(FontSubsetInfo& subset_font,
              ? _ST(".otf")
              : _ST(".ttf")));
     std::error_code ec;
-    if (!fs::is_regular_file(filepath, ec)) {
-      output_filepath = filepath;
-      break;
+    if (!fs::is_regular_file(filepath, ec) &&
+        subfont_paths.insert(filepath.native()).second) {
+      return filepath.native();
     }
   }
-  if (output_filepath.empty()) {
-    return false;
+  return AString();
+}
+
+bool FontSubsetter::CreateSubfont(FontSubsetInfo& subset_font,
+                                  const bool is_rename) {
+  std::string cache_key;
+  std::string cached_data;
+  // Renamed subsets carry a random new name in their name table, so they
+  // would never be looked up again and are not cached.
+  if (subset_cache_ && !is_rename) {
+    cache_key = GetCacheKey(subset_font);
+    if (!cache_key.empty() && subset_cache_->Get(cache_key, cached_data)) {
+      subset_font.subfont_data =
+          std::make_shared<const std::string>(std::move(cached_data));
+      return WriteSubfont(subset_font);
+    }
   }
 
-  std::ifstream is(subset_font.font_path.path, std::ios::binary);
-  const auto font_size = fs::file_size(subset_font.font_path.path);
-  std::string font_data(font_size, '\0');
-  is.read(&font_data[0], font_size);
-  HbBlob hb_blob(hb_blob_create_or_fail(&font_data[0],
-                                        static_cast<unsigned int>(font_size),
-                                        HB_MEMORY_MODE_READONLY, NULL, NULL));
-  HbFace hb_face(hb_face_create(hb_blob.get(), subset_font.font_path.index));
+  auto face =
+      face_cache_->Get(subset_font.font_path.path, subset_font.font_path.index);
+  if (!face) {
+    return false;
+  }
   HbSet codepoint_set(hb_set_create());
   for (const auto& codepoint : subset_font.codepoints) {
     hb_set_add(codepoint_set.get(), codepoint);
@@ -370,41 +426,101 @@ bool FontSubsetter::CreateSubfont(FontSubsetInfo& subset_font,
     hb_set_clear(input_namelangid);
     hb_set_invert(input_namelangid);
   }
-  HbFace subset_face(hb_subset_or_fail(hb_face.get(), input.get()));
+  HbFace subset_face(hb_subset_or_fail(face->hb_face(), input.get()));
   if (subset_face.get() == nullptr) {
     return false;
   }
   HbBlob subset_blob(hb_face_reference_blob(subset_face.get()));
   unsigned int len = 0;
   const char* subset_data = hb_blob_get_data(subset_blob.get(), &len);
+  subset_font.subfont_data =
+      std::make_shared<const std::string>(subset_data, len);
+  if (!WriteSubfont(subset_font) || len == 0) {
+    return false;
+  }
+  if (!cache_key.empty()) {
+    subset_cache_->Put(cache_key, subset_data, len);
+  }
+  return true;
+}
+
+bool FontSubsetter::WriteSubfont(const FontSubsetInfo& subset_font) {
+  if (!is_write_subfonts_) {
+    return true;
+  }
+  fs::path output_filepath(subset_font.subfont_path);
   std::ofstream subset_file(output_filepath.native(), std::ios::binary);
   if (!subset_file.is_open()) {
     return false;
   }
-  subset_file.write(subset_data, len);
-  if (len == 0) {
+  subset_file.write(subset_font.subfont_data->data(),
+                    subset_font.subfont_data->size());
+  subset_file.close();
+  if (subset_file.fail()) {
+    std::error_code ec;
+    fs::remove(output_filepath, ec);
     return false;
   }
-  subset_font.subfont_path = output_filepath.native();
   return true;
 }
 
-bool FontSubsetter::CheckGlyph(
-    const AString& font_path, const long& font_index,
-    const std::unordered_set<char32_t>& codepoint_set, const AString& fontname,
-    int bold, int italic) {
-  std::vector<uint32_t> missing_codepoints;
-  FT_Face ft_face;
-  std::ifstream is(font_path, std::ios::binary);
-  if (!is.is_open()) {
-    logger_->Error(_ST("\"{}\" is inaccessible."), font_path);
+std::string FontSubsetter::GetCacheKey(const FontSubsetInfo& subset_font) {
+  fs::path font_path(subset_font.font_path.path);
+  std::error_code ec;
+  const auto file_size = fs::file_size(font_path, ec);
+  if (ec) {
+    return std::string();
+  }
+  const auto write_time = fs::last_write_time(font_path, ec);
+  if (ec) {
+    return std::string();
+  }
+
+  // CodepointSet iterates in ascending order
+  std::vector<uint32_t> codepoints(subset_font.codepoints.begin(),
+                                   subset_font.codepoints.end());
+
+  std::string key = fmt::format(
+      "assfonts v{}.{}.{}\nharfbuzz {}\n{}\n{} {} {}\n\n",
+      ASSFONTS_VERSION_MAJOR, ASSFONTS_VERSION_MINOR, ASSFONTS_VERSION_PATCH,
+      hb_version_string(), font_path.u8string(), file_size,
+      write_time.time_since_epoch().count(), subset_font.font_path.index);
+
+  for (size_t idx = 0; idx < codepoints.size(); ++idx) {
+    size_t last = idx;
+    while (last + 1 < codepoints.size() &&
+           codepoints[last + 1] == codepoints[last] + 1) {
+      ++last;
+    }
+    key += fmt::format("{:x}-{:x},", codepoints[idx], codepoints[last]);
+    idx = last;
+  }
+
+  return key;
+}
+
+bool FontSubsetter::CheckGlyph(const FontCheck& font_check,
+                               const CodepointSet& codepoint_set,
+                               std::vector<uint32_t>& missing_codepoints) {
+  if (font_check.has_coverage) {
+    for (const auto& codepoint : codepoint_set) {
+      if (codepoint && !HasCodepoint(font_check.coverage,
+                                     font_check.coverage_size, codepoint)) {
+        missing_codepoints.emplace_back(codepoint);
+      }
+    }
+    return true;
+  }
+  auto face = face_cache_->Get(font_check.font_path.path,
+                               font_check.font_path.index);
+  if (!face) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(face->ft_mtx());
+  FT_Face ft_face = face->ft_face();
+  if (ft_face == nullptr) {
     return false;
   }
-  const auto font_size = fs::file_size(font_path);
-  std::string font_data(font_size, '\0');
-  is.read(&font_data[0], font_size);
-  FT_New_Memory_Face(ft_library_, reinterpret_cast<FT_Byte*>(&font_data[0]),
-                     static_cast<FT_Long>(font_size), font_index, &ft_face);
   for (const auto& codepoint : codepoint_set) {
     if (!codepoint) {
       continue;
@@ -413,12 +529,6 @@ bool FontSubsetter::CheckGlyph(
       missing_codepoints.emplace_back(codepoint);
     }
   }
-  if (!missing_codepoints.empty()) {
-    logger_->Warn(_ST("Missing codepoints for \"{}\" ({},{}): {:#06x}"),
-                  fontname, bold, italic,
-                  fmt::join(missing_codepoints, _ST("  ")));
-  }
-  FT_Done_Face(ft_face);
   return true;
 }
 
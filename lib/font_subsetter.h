@@ -20,11 +20,13 @@
 #ifndef ASSFONTS_FONTSUBSETTER_H_
 #define ASSFONTS_FONTSUBSETTER_H_
 
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #ifdef __cplusplus
@@ -37,32 +39,32 @@ extern "C" {
 }
 #endif
 
+#include "ThreadPool.h"
 #include "ass_logger.h"
 #include "ass_parser.h"
 #include "ass_string.h"
+#include "codepoint_set.h"
+#include "font_face_cache.h"
 #include "font_parser.h"
+#include "subset_cache.h"
 
 namespace ass {
 
 class FontSubsetter {
  public:
   FontSubsetter(const FontParser& fp,
-                const std::map<AssParser::FontDesc,
-                               std::unordered_set<char32_t>>& font_sets,
+                const std::map<AssParser::FontDesc, CodepointSet>& font_sets,
                 std::shared_ptr<Logger> logger)
-      : fp_(fp), font_sets_(font_sets), logger_(logger) {
-    FT_Init_FreeType(&ft_library_);
-  };
+      : fp_(fp), font_sets_(font_sets), logger_(logger){};
 
   FontSubsetter(const FontParser& fp,
-                const std::map<AssParser::FontDesc,
-                               std::unordered_set<char32_t>>& font_sets,
+                const std::map<AssParser::FontDesc, CodepointSet>& font_sets,
                 const AString& subfont_dir, std::shared_ptr<Logger> logger)
       : FontSubsetter(fp, font_sets, logger) {
     SetSubfontDir(subfont_dir);
   };
 
-  ~FontSubsetter() { FT_Done_FreeType(ft_library_); }
+  ~FontSubsetter() = default;
 
   struct FontPath {
     AString path;
@@ -79,10 +81,12 @@ class FontSubsetter {
 
   struct FontSubsetInfo {
     std::vector<AssParser::FontDesc> fonts_desc;
-    std::unordered_set<uint32_t> codepoints;
+    CodepointSet codepoints;
     FontPath font_path;
     std::string newname;
     AString subfont_path;
+    // Subset font data handed to the embedder, null if not subsetted
+    std::shared_ptr<const std::string> subfont_data;
   };
 
   FontSubsetter(const FontSubsetter&) = delete;
@@ -90,6 +94,16 @@ class FontSubsetter {
 
   void SetSubfontDir(const AString& subfont_dir);
 
+  // Whether subset fonts are also saved as files in the subfont dir
+  void SetWriteSubfonts(const bool is_write_subfonts);
+
+  void SetSubsetCache(std::shared_ptr<SubsetCache> subset_cache);
+
+  void SetThreadPool(ThreadPool* pool);
+
+  // Without a shared cache, Run() creates a private one
+  void SetFontFaceCache(std::shared_ptr<FontFaceCache> face_cache);
+
   bool Run(const bool is_no_subset, const bool is_rename = false);
 
   std::vector<FontSubsetInfo> get_subfonts_info() const;
@@ -97,26 +111,51 @@ class FontSubsetter {
   void Clear();
 
  private:
-  FT_Library ft_library_;
   const FontParser& fp_;
-  std::map<AssParser::FontDesc, std::unordered_set<char32_t>> font_sets_;
+  std::map<AssParser::FontDesc, CodepointSet> font_sets_;
   std::shared_ptr<Logger> logger_;
   AString subfont_dir_;
+  bool is_write_subfonts_ = true;
   std::vector<FontSubsetInfo> subfonts_info_;
+  std::shared_ptr<SubsetCache> subset_cache_;
+  ThreadPool* pool_ = nullptr;
+  std::shared_ptr<FontFaceCache> face_cache_;
+
+  struct FontCheck {
+    bool is_found = false;
+    bool is_accessible = true;
+    FontPath font_path;
+    bool has_coverage = false;
+    const CodepointRange* coverage = nullptr;
+    size_t coverage_size = 0;
+    std::vector<uint32_t> missing_codepoints;
+  };
+
+  bool FindFont(const std::pair<AssParser::FontDesc, CodepointSet>& font_set,
+                const std::vector<FontParser::FontMatch>& matches,
+                FontParser::FontMatch& found);
+  static bool HasCodepoint(const CodepointRange* coverage,
+                           const size_t coverage_size,
+                           const uint32_t codepoint);
 
-  bool FindFont(
-      const std::pair<AssParser::FontDesc, std::unordered_set<char32_t>>&
-          font_set,
-      const std::unordered_multimap<AString, FontParser::FontInfo>& font_list,
-      AString& found_path, long& found_index);
+  std::vector<FontCheck> CheckFonts();
+  bool LogGlyphCheck(const FontCheck& font_check, const AString& fontname,
+                     int bold, int italic);
+  void RunTasks(const size_t num_tasks,
+                const std::function<void(const size_t)>& task);
 
   bool set_subfonts_info();
 
+  AString GetSubfontPath(const FontSubsetInfo& subset_font,
+                         const bool is_rename,
+                         std::set<AString>& subfont_paths);
   bool CreateSubfont(FontSubsetInfo& subset_font, const bool is_rename);
+  bool WriteSubfont(const FontSubsetInfo& subset_font);
+  std::string GetCacheKey(const FontSubsetInfo& subset_font);
 
-  bool CheckGlyph(const AString& font_path, const long& font_index,
-                  const std::unordered_set<char32_t>& codepoint_set,
-                  const AString& fontname, int bold, int italic);
+  bool CheckGlyph(const FontCheck& font_check,
+                  const CodepointSet& codepoint_set,
+                  std::vector<uint32_t>& missing_codepoints);
   bool LowerCmp(const std::string& a, const std::string& b);
 
   void SetNewname();
@@ -0,0 +1,97 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include "line_reader.h"
+
+#include <cstring>
+
+namespace ass {
+
+bool LineReader::Next(nonstd::string_view& line) {
+  if (is_done_) {
+    return false;
+  }
+
+  size_t scan = pos_;
+
+  while (true) {
+    const char* beg = buf_.data() + scan;
+    const char* found = nullptr;
+    for (const char* p = beg; p != buf_.data() + end_; ++p) {
+      if (*p == '\n' || *p == '\r') {
+        found = p;
+        break;
+      }
+    }
+
+    if (found != nullptr) {
+      size_t eol = found - buf_.data();
+      // A "\r" at the end of the buffer may be the first half of "\r\n"
+      if (*found == '\r' && eol + 1 == end_ && !is_eof_) {
+        scan = eol - pos_;
+        Fill();
+        scan += pos_;
+        continue;
+      }
+      line = nonstd::string_view(buf_.data() + pos_, eol - pos_);
+      pos_ = eol + 1;
+      if (*found == '\r' && pos_ < end_ && buf_[pos_] == '\n') {
+        ++pos_;
+      }
+      return true;
+    }
+
+    if (!is_eof_) {
+      scan = end_ - pos_;
+      Fill();
+      scan += pos_;
+      continue;
+    }
+
+    line = nonstd::string_view(buf_.data() + pos_, end_ - pos_);
+    if (line.empty()) {
+      is_done_ = true;
+    }
+    pos_ = end_;
+    return true;
+  }
+}
+
+// Moves the unread bytes to the front of the buffer and reads the next chunk
+// behind them, growing the buffer when a single line fills it.
+void LineReader::Fill() {
+  if (pos_ != 0) {
+    std::memmove(&buf_[0], buf_.data() + pos_, end_ - pos_);
+    end_ -= pos_;
+    pos_ = 0;
+  }
+  if (end_ == buf_.size()) {
+    buf_.resize(buf_.size() * 2);
+  }
+
+  is_.read(&buf_[end_], static_cast<std::streamsize>(buf_.size() - end_));
+  const auto count = is_.gcount();
+  if (count <= 0) {
+    is_eof_ = true;
+    return;
+  }
+  end_ += static_cast<size_t>(count);
+}
+
+}  // namespace ass
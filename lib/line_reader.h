@@ -0,0 +1,60 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_LINEREADER_H_
+#define ASSFONTS_LINEREADER_H_
+
+#include <cstddef>
+#include <istream>
+#include <string>
+
+#include <nonstd/string_view.hpp>
+
+namespace ass {
+
+// Reads a stream line by line through a fixed-size chunk buffer, splitting
+// the way SafeGetLine() does: "\n", "\r\n" and "\r" end a line, and the
+// input always ends with an empty line. The buffer only grows for lines
+// longer than a chunk.
+class LineReader {
+ public:
+  LineReader(std::istream& is, const size_t chunk_size = 1 << 20)
+      : is_(is), buf_(chunk_size, '\0'){};
+  ~LineReader() = default;
+
+  LineReader(const LineReader&) = delete;
+  LineReader& operator=(const LineReader&) = delete;
+
+  // The returned line stays valid until the next call
+  bool Next(nonstd::string_view& line);
+
+ private:
+  std::istream& is_;
+  std::string buf_;
+  size_t pos_ = 0;
+  size_t end_ = 0;
+  bool is_eof_ = false;
+  bool is_done_ = false;
+
+  void Fill();
+};
+
+}  // namespace ass
+
+#endif
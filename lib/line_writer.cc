@@ -0,0 +1,52 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include "line_writer.h"
+
+namespace ass {
+
+void LineWriter::Write(const nonstd::string_view line) {
+  if (!is_first_) {
+    Append("\n");
+  }
+  is_first_ = false;
+  Append(line);
+}
+
+void LineWriter::Append(const nonstd::string_view text) {
+  if (buf_.size() + text.size() > buffer_size_) {
+    Flush();
+    if (text.size() >= buffer_size_) {
+      os_.write(text.data(), static_cast<std::streamsize>(text.size()));
+      return;
+    }
+  }
+  buf_.append(text.data(), text.size());
+}
+
+bool LineWriter::Flush() {
+  if (!buf_.empty()) {
+    os_.write(buf_.data(), static_cast<std::streamsize>(buf_.size()));
+    buf_.clear();
+  }
+  os_.flush();
+  return os_.good();
+}
+
+}  // namespace ass
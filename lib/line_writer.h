@@ -0,0 +1,59 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_LINEWRITER_H_
+#define ASSFONTS_LINEWRITER_H_
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+#include <nonstd/string_view.hpp>
+
+namespace ass {
+
+// Writes lines to a stream through a fixed-size buffer, separated by "\n"
+// with none after the last line. Text larger than the buffer bypasses it.
+class LineWriter {
+ public:
+  LineWriter(std::ostream& os, const size_t buffer_size = 1 << 20)
+      : os_(os), buffer_size_(buffer_size) {
+    buf_.reserve(buffer_size);
+  };
+  ~LineWriter() = default;
+
+  LineWriter(const LineWriter&) = delete;
+  LineWriter& operator=(const LineWriter&) = delete;
+
+  // Starts a new line
+  void Write(const nonstd::string_view line);
+  // Continues the current line
+  void Append(const nonstd::string_view text);
+  bool Flush();
+
+ private:
+  std::ostream& os_;
+  std::string buf_;
+  size_t buffer_size_;
+  bool is_first_ = true;
+};
+
+}  // namespace ass
+
+#endif
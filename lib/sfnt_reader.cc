@@ -0,0 +1,459 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include "sfnt_reader.h"
+
+#include <algorithm>
+
+namespace ass {
+
+static constexpr uint32_t MakeTag(const char a, const char b, const char c,
+                                  const char d) {
+  return (static_cast<uint32_t>(static_cast<uint8_t>(a)) << 24) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(b)) << 16) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(c)) << 8) |
+         static_cast<uint32_t>(static_cast<uint8_t>(d));
+}
+
+static constexpr uint32_t TAG_TTCF = MakeTag('t', 't', 'c', 'f');
+static constexpr uint32_t TAG_TRUE = MakeTag('t', 'r', 'u', 'e');
+static constexpr uint32_t TAG_OTTO = MakeTag('O', 'T', 'T', 'O');
+static constexpr uint32_t TAG_SFNT = 0x00010000;
+
+static constexpr uint32_t TAG_CFF = MakeTag('C', 'F', 'F', ' ');
+static constexpr uint32_t TAG_CFF2 = MakeTag('C', 'F', 'F', '2');
+static constexpr uint32_t TAG_CMAP = MakeTag('c', 'm', 'a', 'p');
+static constexpr uint32_t TAG_GLYF = MakeTag('g', 'l', 'y', 'f');
+static constexpr uint32_t TAG_HEAD = MakeTag('h', 'e', 'a', 'd');
+static constexpr uint32_t TAG_HHEA = MakeTag('h', 'h', 'e', 'a');
+static constexpr uint32_t TAG_HMTX = MakeTag('h', 'm', 't', 'x');
+static constexpr uint32_t TAG_LOCA = MakeTag('l', 'o', 'c', 'a');
+static constexpr uint32_t TAG_MAXP = MakeTag('m', 'a', 'x', 'p');
+static constexpr uint32_t TAG_NAME = MakeTag('n', 'a', 'm', 'e');
+static constexpr uint32_t TAG_OS2 = MakeTag('O', 'S', '/', '2');
+static constexpr uint32_t TAG_VMTX = MakeTag('v', 'm', 't', 'x');
+
+static inline uint16_t ReadU16(const uint8_t* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t ReadU32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+bool SfntReader::Open(const char* data, const size_t size) {
+  data_ = reinterpret_cast<const uint8_t*>(data);
+  size_ = size;
+  faces_.clear();
+
+  if (size_ < 12) {
+    return false;
+  }
+
+  const uint32_t tag = ReadU32(data_);
+
+  if (tag == TAG_TTCF) {
+    const uint32_t num_fonts = ReadU32(data_ + 8);
+    if (num_fonts == 0 || num_fonts > (size_ - 12) / 4) {
+      return false;
+    }
+    faces_.resize(num_fonts);
+    // A broken face keeps an empty directory and is left to FreeType.
+    for (uint32_t face = 0; face < num_fonts; ++face) {
+      if (!ReadTableDirectory(ReadU32(data_ + 12 + 4 * face), faces_[face])) {
+        faces_[face].clear();
+      }
+    }
+    return true;
+  }
+
+  if (tag == TAG_SFNT || tag == TAG_TRUE || tag == TAG_OTTO) {
+    faces_.resize(1);
+    return ReadTableDirectory(0, faces_[0]);
+  }
+
+  return false;
+}
+
+bool SfntReader::ReadTableDirectory(const uint32_t offset,
+                                    std::vector<Table>& tables) {
+  if (static_cast<uint64_t>(offset) + 12 > size_) {
+    return false;
+  }
+
+  const uint16_t num_tables = ReadU16(data_ + offset + 4);
+  if (static_cast<uint64_t>(offset) + 12 + 16 * num_tables > size_) {
+    return false;
+  }
+
+  for (uint16_t idx = 0; idx < num_tables; ++idx) {
+    const uint8_t* record = data_ + offset + 12 + 16 * idx;
+    Table table = {ReadU32(record), ReadU32(record + 8), ReadU32(record + 12)};
+    if (table.offset > size_) {
+      continue;
+    }
+    // Like FreeType, only metrics tables may be clipped to the file size.
+    if (table.length > size_ - table.offset) {
+      if (table.tag != TAG_HMTX && table.tag != TAG_VMTX) {
+        continue;
+      }
+      table.length = static_cast<uint32_t>(size_ - table.offset);
+    }
+    tables.emplace_back(table);
+  }
+
+  return true;
+}
+
+const SfntReader::Table* SfntReader::FindTable(const long face,
+                                               const uint32_t tag) const {
+  for (const auto& table : faces_[face]) {
+    if (table.tag == tag && table.length != 0) {
+      return &table;
+    }
+  }
+  return nullptr;
+}
+
+bool SfntReader::HasRequiredTables(const long face) const {
+  if (face < 0 || face >= num_faces()) {
+    return false;
+  }
+  const bool has_outlines =
+      (FindTable(face, TAG_GLYF) && FindTable(face, TAG_LOCA)) ||
+      FindTable(face, TAG_CFF) || FindTable(face, TAG_CFF2);
+  return has_outlines && FindTable(face, TAG_HEAD) &&
+         FindTable(face, TAG_HHEA) && FindTable(face, TAG_HMTX) &&
+         FindTable(face, TAG_MAXP);
+}
+
+bool SfntReader::GetNames(const long face, std::vector<Name>& names) const {
+  names.clear();
+
+  const Table* table = FindTable(face, TAG_NAME);
+  if (table == nullptr) {
+    return true;
+  }
+  if (table->length < 6) {
+    return false;
+  }
+
+  const uint8_t* base = data_ + table->offset;
+  const uint16_t format = ReadU16(base);
+  const uint16_t count = ReadU16(base + 2);
+  const uint16_t storage_offset = ReadU16(base + 4);
+
+  uint64_t storage_start = 6 + 12 * static_cast<uint64_t>(count);
+  if (storage_start > table->length) {
+    return false;
+  }
+
+  uint16_t num_lang_tags = 0;
+  if (format == 1) {
+    if (storage_start + 2 > table->length) {
+      return false;
+    }
+    num_lang_tags = ReadU16(base + storage_start);
+    storage_start += 2 + 4 * static_cast<uint64_t>(num_lang_tags);
+    if (storage_start > table->length) {
+      return false;
+    }
+  }
+
+  for (uint16_t idx = 0; idx < count; ++idx) {
+    const uint8_t* record = base + 6 + 12 * idx;
+    Name name;
+    name.platform_id = ReadU16(record);
+    name.encoding_id = ReadU16(record + 2);
+    name.language_id = ReadU16(record + 4);
+    name.name_id = ReadU16(record + 6);
+    name.string_len = ReadU16(record + 8);
+
+    // Invalid records are skipped as FreeType does.
+    if (name.string_len == 0) {
+      continue;
+    }
+    const uint64_t string_offset =
+        static_cast<uint64_t>(storage_offset) + ReadU16(record + 10);
+    if (string_offset < storage_start ||
+        string_offset + name.string_len > table->length) {
+      continue;
+    }
+    if (format == 1 && name.language_id >= 0x8000 &&
+        name.language_id - 0x8000 >= num_lang_tags) {
+      continue;
+    }
+
+    name.string = reinterpret_cast<const char*>(base + string_offset);
+    names.emplace_back(name);
+  }
+
+  return true;
+}
+
+bool SfntReader::GetStyle(const long face, Style& style) const {
+  style = Style();
+
+  const Table* head = FindTable(face, TAG_HEAD);
+  if (head == nullptr || head->length < 54) {
+    return false;
+  }
+
+  const Table* os2 = FindTable(face, TAG_OS2);
+  if (os2 == nullptr) {
+    // Old Mac fonts only have the head table.
+    const uint16_t mac_style = ReadU16(data_ + head->offset + 44);
+    style.is_bold = mac_style & 1;
+    style.is_italic = mac_style & 2;
+    return true;
+  }
+
+  const uint8_t* base = data_ + os2->offset;
+  if (os2->length < 78) {
+    return false;
+  }
+  const uint16_t version = ReadU16(base);
+  if ((version >= 1 && os2->length < 86) ||
+      (version >= 2 && os2->length < 96) ||
+      (version >= 5 && os2->length < 100)) {
+    return false;
+  }
+
+  const uint16_t fs_selection = ReadU16(base + 62);
+  style.has_os2 = true;
+  style.weight_class = ReadU16(base + 4);
+  style.is_bold = fs_selection & 32;
+  // Bit 9 marks oblique faces, which FreeType reports as italic as well.
+  style.is_italic = (fs_selection & 512) || (fs_selection & 1);
+  return true;
+}
+
+bool SfntReader::GetGlyphCount(const long face, uint32_t& num_glyphs) const {
+  const Table* maxp = FindTable(face, TAG_MAXP);
+  if (maxp == nullptr || maxp->length < 6) {
+    return false;
+  }
+  num_glyphs = ReadU16(data_ + maxp->offset + 4);
+  return true;
+}
+
+bool SfntReader::GetCoverage(const long face,
+                             std::vector<CodepointRange>& coverage) const {
+  coverage.clear();
+
+  uint32_t num_glyphs = 0;
+  if (!GetGlyphCount(face, num_glyphs)) {
+    return false;
+  }
+
+  const Table* cmap = FindTable(face, TAG_CMAP);
+  if (cmap == nullptr || cmap->length < 4) {
+    return false;
+  }
+
+  const uint8_t* base = data_ + cmap->offset;
+  const uint16_t num_subtables = ReadU16(base + 2);
+  if (4 + 8 * static_cast<uint64_t>(num_subtables) > cmap->length) {
+    return false;
+  }
+
+  // FreeType prefers the last UCS-4 subtable, then the last Unicode one.
+  const uint8_t* ucs4 = nullptr;
+  const uint8_t* ucs2 = nullptr;
+  for (uint16_t idx = 0; idx < num_subtables; ++idx) {
+    const uint8_t* record = base + 4 + 8 * idx;
+    const uint16_t platform_id = ReadU16(record);
+    const uint16_t encoding_id = ReadU16(record + 2);
+    const uint32_t offset = ReadU32(record + 4);
+    if (static_cast<uint64_t>(offset) + 2 > cmap->length ||
+        ReadU16(base + offset) == 14) {
+      continue;
+    }
+    const bool is_unicode = platform_id == 0 || platform_id == 2 ||
+                            (platform_id == 3 &&
+                             (encoding_id == 1 || encoding_id == 10));
+    if (!is_unicode) {
+      continue;
+    }
+    ucs2 = base + offset;
+    if ((platform_id == 3 && encoding_id == 10) ||
+        (platform_id == 0 && encoding_id == 4)) {
+      ucs4 = base + offset;
+    }
+  }
+
+  const uint8_t* subtable = ucs4 ? ucs4 : ucs2;
+  if (subtable == nullptr) {
+    return false;
+  }
+
+  std::vector<CodepointRange> ranges;
+  if (!ReadCmapSubtable(subtable, base + cmap->length - subtable, num_glyphs,
+                        ranges)) {
+    return false;
+  }
+
+  std::sort(ranges.begin(), ranges.end(),
+            [](const CodepointRange& a, const CodepointRange& b) {
+              return a.first < b.first ||
+                     (a.first == b.first && a.last < b.last);
+            });
+  for (const auto& range : ranges) {
+    if (!coverage.empty() &&
+        static_cast<uint64_t>(coverage.back().last) + 1 >= range.first) {
+      coverage.back().last = std::max(coverage.back().last, range.last);
+    } else {
+      coverage.emplace_back(range);
+    }
+  }
+
+  return true;
+}
+
+bool SfntReader::ReadCmapSubtable(
+    const uint8_t* subtable, const size_t size, const uint32_t num_glyphs,
+    std::vector<CodepointRange>& ranges) const {
+  auto add_glyph = [&](const uint32_t codepoint, const uint32_t glyph) {
+    if (glyph == 0 || glyph >= num_glyphs) {
+      return;
+    }
+    if (!ranges.empty() && ranges.back().last + 1 == codepoint) {
+      ranges.back().last = codepoint;
+    } else {
+      ranges.push_back({codepoint, codepoint});
+    }
+  };
+
+  switch (ReadU16(subtable)) {
+    case 0: {
+      if (size < 6 + 256) {
+        return false;
+      }
+      for (uint32_t codepoint = 0; codepoint < 256; ++codepoint) {
+        add_glyph(codepoint, subtable[6 + codepoint]);
+      }
+      return true;
+    }
+
+    case 4: {
+      if (size < 14) {
+        return false;
+      }
+      // Some fonts have a wrong length, so clip it to the table.
+      const size_t limit = std::min<size_t>(ReadU16(subtable + 2), size);
+      const uint32_t seg_count = ReadU16(subtable + 6) / 2;
+      if (16 + 8 * static_cast<uint64_t>(seg_count) > limit) {
+        return false;
+      }
+      const uint8_t* end_codes = subtable + 14;
+      const uint8_t* start_codes = end_codes + 2 * seg_count + 2;
+      const uint8_t* id_deltas = start_codes + 2 * seg_count;
+      const uint8_t* id_range_offsets = id_deltas + 2 * seg_count;
+      for (uint32_t seg = 0; seg < seg_count; ++seg) {
+        const uint32_t start = ReadU16(start_codes + 2 * seg);
+        const uint32_t end = ReadU16(end_codes + 2 * seg);
+        const uint16_t delta = ReadU16(id_deltas + 2 * seg);
+        const uint16_t range_offset = ReadU16(id_range_offsets + 2 * seg);
+        if (start > end || range_offset == 0xFFFF) {
+          continue;
+        }
+        for (uint32_t codepoint = start; codepoint <= end; ++codepoint) {
+          uint32_t glyph = 0;
+          if (range_offset == 0) {
+            glyph = (codepoint + delta) & 0xFFFF;
+          } else {
+            const uint64_t pos = (id_range_offsets + 2 * seg - subtable) +
+                                 range_offset + 2 * (codepoint - start);
+            if (pos + 2 > limit) {
+              break;
+            }
+            glyph = ReadU16(subtable + pos);
+            if (glyph != 0) {
+              glyph = (glyph + delta) & 0xFFFF;
+            }
+          }
+          add_glyph(codepoint, glyph);
+        }
+      }
+      return true;
+    }
+
+    case 6: {
+      if (size < 10) {
+        return false;
+      }
+      const uint32_t first_code = ReadU16(subtable + 6);
+      const uint32_t entry_count = ReadU16(subtable + 8);
+      if (10 + 2 * static_cast<uint64_t>(entry_count) > size) {
+        return false;
+      }
+      for (uint32_t idx = 0; idx < entry_count; ++idx) {
+        add_glyph(first_code + idx, ReadU16(subtable + 10 + 2 * idx));
+      }
+      return true;
+    }
+
+    case 12:
+    case 13: {
+      if (size < 16) {
+        return false;
+      }
+      const bool is_many_to_one = ReadU16(subtable) == 13;
+      const uint32_t num_groups = ReadU32(subtable + 12);
+      if (16 + 12 * static_cast<uint64_t>(num_groups) > size) {
+        return false;
+      }
+      for (uint32_t idx = 0; idx < num_groups; ++idx) {
+        const uint8_t* group = subtable + 16 + 12 * idx;
+        const uint32_t start = ReadU32(group);
+        const uint32_t end = ReadU32(group + 4);
+        const uint32_t glyph = ReadU32(group + 8);
+        if (start > end || num_glyphs == 0) {
+          continue;
+        }
+        if (is_many_to_one) {
+          if (glyph != 0 && glyph < num_glyphs) {
+            ranges.push_back({start, end});
+          }
+          continue;
+        }
+        // Keep the codepoints whose glyph lies in [1, num_glyphs).
+        const uint64_t first = glyph == 0 ? static_cast<uint64_t>(start) + 1
+                                          : start;
+        if (glyph >= num_glyphs) {
+          continue;
+        }
+        const uint64_t last = std::min<uint64_t>(
+            end, static_cast<uint64_t>(start) + (num_glyphs - 1 - glyph));
+        if (first <= last) {
+          ranges.push_back(
+              {static_cast<uint32_t>(first), static_cast<uint32_t>(last)});
+        }
+      }
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
+
+}  // namespace ass
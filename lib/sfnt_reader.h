@@ -0,0 +1,96 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_SFNTREADER_H_
+#define ASSFONTS_SFNTREADER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "codepoint_set.h"
+
+namespace ass {
+
+// Reads the table directory of an sfnt font or a TrueType/OpenType
+// collection in place, so every face of a collection is read from one
+// buffer. Only the tables needed to index a face are decoded: name, OS/2,
+// head, maxp and the Unicode cmap. The results follow the conventions
+// FreeType uses for the same tables, and any method returning false means
+// the caller should fall back to FreeType.
+class SfntReader {
+ public:
+  struct Name {
+    uint16_t platform_id;
+    uint16_t encoding_id;
+    uint16_t language_id;
+    uint16_t name_id;
+    const char* string;
+    uint16_t string_len;
+  };
+
+  struct Style {
+    bool has_os2 = false;
+    uint16_t weight_class = 0;
+    bool is_bold = false;
+    bool is_italic = false;
+  };
+
+  SfntReader() = default;
+  ~SfntReader() = default;
+
+  bool Open(const char* data, const size_t size);
+
+  inline long num_faces() const { return static_cast<long>(faces_.size()); }
+
+  // Whether the face has outlines and the tables FreeType requires to open
+  // it, so it can be indexed without FreeType.
+  bool HasRequiredTables(const long face) const;
+
+  bool GetNames(const long face, std::vector<Name>& names) const;
+
+  bool GetStyle(const long face, Style& style) const;
+
+  bool GetCoverage(const long face,
+                   std::vector<CodepointRange>& coverage) const;
+
+ private:
+  struct Table {
+    uint32_t tag;
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  std::vector<std::vector<Table>> faces_;
+
+  bool ReadTableDirectory(const uint32_t offset, std::vector<Table>& tables);
+  const Table* FindTable(const long face, const uint32_t tag) const;
+
+  bool GetGlyphCount(const long face, uint32_t& num_glyphs) const;
+  bool ReadCmapSubtable(const uint8_t* subtable, const size_t size,
+                        const uint32_t num_glyphs,
+                        std::vector<CodepointRange>& ranges) const;
+};
+
+}  // namespace ass
+
+#endif
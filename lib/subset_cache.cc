@@ -0,0 +1,222 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#include "subset_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+#include <ghc/filesystem.hpp>
+
+namespace fs = ghc::filesystem;
+
+namespace ass {
+
+static constexpr auto TMP_EXPIRY = std::chrono::hours(1);
+
+static constexpr char ENTRY_MAGIC[8] = {'A', 'S', 'S', 'F', 'S', 'U', 'B',
+                                        '1'};
+
+SubsetCache::SubsetCache(const AString& cache_dir, const uintmax_t max_size)
+    : cache_dir_(cache_dir), max_size_(max_size) {
+  Scan(false);
+}
+
+bool SubsetCache::Get(const std::string& key, std::string& data) {
+  fs::path entry_path(GetEntryPath(key));
+  std::ifstream is(entry_path.native(), std::ios::binary);
+  if (!is.is_open()) {
+    return false;
+  }
+
+  char magic[sizeof(ENTRY_MAGIC)] = {};
+  uint64_t key_size = 0;
+  is.read(magic, sizeof(magic));
+  is.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
+  if (!is || std::memcmp(magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) != 0 ||
+      key_size != key.size()) {
+    return false;
+  }
+
+  std::string entry_key(key.size(), '\0');
+  is.read(&entry_key[0], entry_key.size());
+  if (!is || entry_key != key) {
+    return false;
+  }
+
+  std::error_code ec;
+  const auto file_size = fs::file_size(entry_path, ec);
+  const auto header_size = sizeof(ENTRY_MAGIC) + sizeof(key_size) + key.size();
+  if (ec || file_size <= header_size) {
+    return false;
+  }
+
+  data.resize(static_cast<size_t>(file_size - header_size));
+  is.read(&data[0], data.size());
+  if (!is) {
+    data.clear();
+    return false;
+  }
+
+  fs::last_write_time(entry_path, fs::file_time_type::clock::now(), ec);
+
+  return true;
+}
+
+bool SubsetCache::Put(const std::string& key, const char* data,
+                      const size_t size) {
+  std::error_code ec;
+  fs::create_directories(fs::path(cache_dir_), ec);
+
+  // Other threads or processes sharing the cache may be writing the same
+  // entry, so each write goes to its own temporary file.
+  std::random_device rd;
+  fs::path entry_path(GetEntryPath(key));
+  fs::path tmp_path(entry_path.native() +
+                    fs::path(fmt::format(".{:08x}{:08x}.tmp", rd(), rd()))
+                        .native());
+
+  std::ofstream os(tmp_path.native(), std::ios::binary);
+  if (!os.is_open()) {
+    return false;
+  }
+
+  const uint64_t key_size = key.size();
+  os.write(ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+  os.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+  os.write(key.data(), key.size());
+  os.write(data, size);
+  os.close();
+
+  if (os.fail()) {
+    fs::remove(tmp_path, ec);
+    return false;
+  }
+
+  const uintmax_t entry_size =
+      sizeof(ENTRY_MAGIC) + sizeof(key_size) + key.size() + size;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+
+  const auto old_size = fs::file_size(entry_path, ec);
+  const bool is_replaced = !ec;
+
+  fs::rename(tmp_path, entry_path, ec);
+  if (ec) {
+    fs::remove(tmp_path, ec);
+    return false;
+  }
+
+  total_size_ += entry_size;
+  if (is_replaced) {
+    total_size_ -= std::min(old_size, total_size_);
+  }
+
+  if (total_size_ > max_size_) {
+    Scan(true);
+  }
+
+  return true;
+}
+
+AString SubsetCache::GetEntryPath(const std::string& key) const {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char ch : key) {
+    hash ^= static_cast<unsigned char>(ch);
+    hash *= 0x100000001b3ULL;
+  }
+
+  fs::path entry_path = fs::path(cache_dir_) /
+                        fs::path(fmt::format("{:016x}.subset", hash));
+  return entry_path.native();
+}
+
+void SubsetCache::Scan(const bool is_evict) {
+  std::vector<std::pair<fs::file_time_type, fs::path>> entries;
+  std::vector<fs::path> stale_tmps;
+  uintmax_t total_size = 0;
+  std::error_code ec;
+
+  // Temporary files are renamed right after they are written, so any that
+  // are older than TMP_EXPIRY were left by a process that did not finish.
+  const auto tmp_expiry = fs::file_time_type::clock::now() - TMP_EXPIRY;
+
+  for (fs::directory_iterator iter(fs::path(cache_dir_), ec), end;
+       !ec && iter != end; iter.increment(ec)) {
+    if (iter->path().extension() == fs::path(".tmp")) {
+      std::error_code entry_ec;
+      const auto time = fs::last_write_time(iter->path(), entry_ec);
+      if (!entry_ec && time < tmp_expiry) {
+        stale_tmps.emplace_back(iter->path());
+      }
+      continue;
+    }
+
+    if (iter->path().extension() != fs::path(".subset")) {
+      continue;
+    }
+
+    std::error_code entry_ec;
+    const auto size = fs::file_size(iter->path(), entry_ec);
+    const auto time = fs::last_write_time(iter->path(), entry_ec);
+    if (entry_ec) {
+      continue;
+    }
+
+    total_size += size;
+    entries.emplace_back(time, iter->path());
+  }
+
+  for (const auto& tmp : stale_tmps) {
+    std::error_code entry_ec;
+    fs::remove(tmp, entry_ec);
+  }
+
+  total_size_ = total_size;
+
+  if (!is_evict || total_size <= max_size_) {
+    return;
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  for (const auto& entry : entries) {
+    if (total_size <= max_size_) {
+      break;
+    }
+
+    std::error_code entry_ec;
+    const auto size = fs::file_size(entry.second, entry_ec);
+    if (!entry_ec && fs::remove(entry.second, entry_ec)) {
+      total_size -= size;
+    }
+  }
+
+  total_size_ = total_size;
+}
+
+}  // namespace ass
@@ -0,0 +1,65 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_SUBSETCACHE_H_
+#define ASSFONTS_SUBSETCACHE_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "ass_string.h"
+
+namespace ass {
+
+// Persistent cache of subset font blobs. Each entry is stored in its own
+// file named by the hash of its key, and the full key is kept in the file
+// so hash collisions are detected. The least recently used entries are
+// removed once the cache grows beyond max_size bytes. The total size is
+// tracked in memory, so the directory is only listed on construction and
+// when entries have to be evicted.
+class SubsetCache {
+ public:
+  SubsetCache(const AString& cache_dir, const uintmax_t max_size);
+  ~SubsetCache() = default;
+
+  SubsetCache(const SubsetCache&) = delete;
+  SubsetCache& operator=(const SubsetCache&) = delete;
+
+  bool Get(const std::string& key, std::string& data);
+
+  bool Put(const std::string& key, const char* data, const size_t size);
+
+ private:
+  AString cache_dir_;
+  uintmax_t max_size_;
+  uintmax_t total_size_ = 0;
+  std::mutex mtx_;
+
+  AString GetEntryPath(const std::string& key) const;
+
+  // Sums up the entries on disk and removes stale temporary files. If
+  // is_evict is set, also removes the least recently used entries while
+  // they exceed max_size_.
+  void Scan(const bool is_evict);
+};
+
+}  // namespace ass
+
+#endif
@@ -0,0 +1,50 @@
+/*  This file is part of assfonts.
+ *
+ *  assfonts is free software: you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation,
+ *  either version 3 of the License,
+ *  or (at your option) any later version.
+ *
+ *  assfonts is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with assfonts. If not, see <https://www.gnu.org/licenses/>.
+ *  
+ *  written by wyzdwdz (https://github.com/wyzdwdz)
+ */
+
+#ifndef ASSFONTS_WAITALL_H_
+#define ASSFONTS_WAITALL_H_
+
+#include <exception>
+#include <future>
+#include <vector>
+
+namespace ass {
+
+// Waits for every future, then rethrows the first exception any of them
+// stored. Tasks often borrow the caller's locals, so the caller must not
+// unwind while some of them are still running.
+inline void WaitAll(std::vector<std::future<void>>& results) {
+  std::exception_ptr error;
+  for (auto& result : results) {
+    try {
+      result.get();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}  // namespace ass
+
+#endif
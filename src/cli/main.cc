@@ -140,9 +140,14 @@ int main(int argc, char** argv) {
   bool is_rename = false;
   bool is_help = false;
   bool is_font_combined = false;
+  bool is_combined_embed = false;
+  bool is_no_subfont_files = false;
+  bool is_no_intermediate_files = false;
 
   unsigned int brightness = 0;
   unsigned int num_thread = 1;
+  unsigned int face_cache_size = ASSFONTS_DEFAULT_FACE_CACHE_SIZE;
+  unsigned int subset_cache_size = ASSFONTS_DEFAULT_SUBSET_CACHE_SIZE;
   int verbose = 3;
 
   CLI::App app{"Subset fonts and embed them into an ASS subtitle."};
@@ -177,6 +182,21 @@ int main(int argc, char** argv) {
   app.add_flag("-c,--font-combined", is_font_combined,
                "Combine fonts with the same fontname together");
 
+  app.add_flag("--combined-embed", is_combined_embed,
+               "Embed combined fonts into every file");
+
+  app.add_flag("-n,--no-subfont-files", is_no_subfont_files,
+               "Embed subsetted fonts without saving them as files");
+
+  app.add_flag("-x,--no-intermediate-files", is_no_intermediate_files,
+               "Only write the font-embedded subtitle");
+
+  auto* p_opt_fc = app.add_option("--face-cache", face_cache_size,
+                                  "Set font face cache size in MiB");
+
+  auto* p_opt_sc = app.add_option("--subset-cache", subset_cache_size,
+                                  "Set subset cache size in MiB");
+
   auto* p_opt_v = app.add_option("-v,--verbose", verbose, "Set logging level.");
 
   app.set_help_flag("");
@@ -205,6 +225,12 @@ int main(int argc, char** argv) {
 
   p_opt_b->needs(p_opt_f);
 
+  p_opt_fc->type_name("<MiB>");
+  p_opt_fc->check(CLI::Range(0u, 1u << 20));
+
+  p_opt_sc->type_name("<MiB>");
+  p_opt_sc->check(CLI::Range(0u, 1u << 20));
+
   p_opt_v->type_name("<num>");
   p_opt_v->check(CLI::Range(0, 3));
 
@@ -247,6 +273,19 @@ int main(int argc, char** argv) {
     << "                                (Default: <cpu_count> + 1)\n"
     << "  -c, --font-combined <bool>    !!Experimental!! When there are multiple input files, combine the\n"
     << "                                subsetted fonts with the same fontname together (Default: False)\n"
+    << "      --combined-embed <bool>   Embed the combined fonts into every file  (Require: --font-combined)\n"
+    << "                                (Default: False)\n"
+    << "  -n, --no-subfont-files <bool> Embed subsetted fonts without saving them as font files\n"
+    << "                                (Ignored with --subset-only, or --font-combined without\n"
+    << "                                --combined-embed) (Default: False)\n"
+    << "  -x, --no-intermediate-files <bool>\n"
+    << "                                Only write the font-embedded subtitle, without the .rename and\n"
+    << "                                .cleaned copies (Ignored with --subset-only, or --font-combined\n"
+    << "                                without --combined-embed) (Default: False)\n"
+    << "      --face-cache    <MiB>     Memory budget for parsed fonts shared by all input files\n"
+    << "                                (Default: 512)\n"
+    << "      --subset-cache  <MiB>     Size limit of the subset cache in the database directory,\n"
+    << "                                0 turns it off (Default: 1024)\n"
     << "  -v, --verbose       <num>     Set logging level (0 to 3), 0 is off  (Default: 3)\n"
     << "  -h, --help                    Get help info\n" << std::endl;
     // clang-format on
@@ -309,8 +348,9 @@ int main(int argc, char** argv) {
   AssfontsRun(const_cast<const char**>(inputs_char_list.get()), inputs.size(),
               output.c_str(), const_cast<const char**>(fonts_char_list.get()),
               fonts.size(), database.c_str(), brightness, is_subset_only,
-              is_embed_only, is_rename, is_font_combined, num_thread,
-              log_callback, max_log_level);
+              is_embed_only, is_rename, is_font_combined, is_combined_embed,
+              is_no_subfont_files, is_no_intermediate_files, face_cache_size,
+              subset_cache_size, num_thread, log_callback, max_log_level);
 
   return 0;
 }
\ No newline at end of file
@@ -108,6 +108,18 @@ void MainWindow::InitMenu() {
   combined_action_->setCheckable(true);
   combined_action_->setChecked(false);
 
+  combined_embed_action_ = new QAction(tr("&Embed combined fonts"));
+  combined_embed_action_->setCheckable(true);
+  combined_embed_action_->setChecked(false);
+
+  no_subfont_files_action_ = new QAction(tr("&No subfont files"));
+  no_subfont_files_action_->setCheckable(true);
+  no_subfont_files_action_->setChecked(false);
+
+  no_intermediate_files_action_ = new QAction(tr("No &intermediate files"));
+  no_intermediate_files_action_->setCheckable(true);
+  no_intermediate_files_action_->setChecked(false);
+
   reset_action_ = new QAction(tr("&Reset all"));
 
   check_action_ = new QAction(tr("&Check update"));
@@ -135,6 +147,9 @@ void MainWindow::InitMenu() {
 
   info_menu_->addAction(mt_action_);
   info_menu_->addAction(combined_action_);
+  info_menu_->addAction(combined_embed_action_);
+  info_menu_->addAction(no_subfont_files_action_);
+  info_menu_->addAction(no_intermediate_files_action_);
   info_menu_->addAction(reset_action_);
   info_menu_->addAction(check_action_);
 
@@ -372,6 +387,17 @@ void MainWindow::InitToolTips() {
   combined_action_->setToolTip(
       tr("!!Experimental!! When there are multiple input files,\n"
          "combine the subsetted fonts with the same fontname together"));
+
+  combined_embed_action_->setToolTip(
+      tr("Embed the combined fonts into every file.\n"
+         "Only used with font combined"));
+
+  no_subfont_files_action_->setToolTip(
+      tr("Embed subsetted fonts without saving them as font files"));
+
+  no_intermediate_files_action_->setToolTip(
+      tr("Only write the font-embedded subtitle,\n"
+         "without the .rename and .cleaned copies"));
 }
 
 void MainWindow::InitAllConnects() {
@@ -655,7 +681,11 @@ void MainWindow::OnStartButtonPressed() {
       input_line_->text().trimmed(), output_line_->text().trimmed(),
       font_line_->text().trimmed(), database_line_->text().trimmed(),
       brightness, subset_checkbox_->isChecked(), embed_checkbox_->isChecked(),
-      rename_checkbox_->isChecked(), combined_action_->isChecked(), num_thread);
+      rename_checkbox_->isChecked(), combined_action_->isChecked(),
+      combined_embed_action_->isChecked(),
+      no_subfont_files_action_->isChecked(),
+      no_intermediate_files_action_->isChecked(), face_cache_size_,
+      subset_cache_size_, num_thread);
 }
 
 void MainWindow::OnReceiveLog(QString msg, ASSFONTS_LOG_LEVEL log_level) {
@@ -895,6 +925,30 @@ void MainWindow::LoadSettings() {
     combined_action_->setChecked(settings_->value("CombinedFonts").toBool());
   }
 
+  if (settings_->contains("CombinedEmbed")) {
+    combined_embed_action_->setChecked(
+        settings_->value("CombinedEmbed").toBool());
+  }
+
+  if (settings_->contains("NoSubfontFiles")) {
+    no_subfont_files_action_->setChecked(
+        settings_->value("NoSubfontFiles").toBool());
+  }
+
+  if (settings_->contains("NoIntermediateFiles")) {
+    no_intermediate_files_action_->setChecked(
+        settings_->value("NoIntermediateFiles").toBool());
+  }
+
+  settings_->endGroup();
+
+  settings_->beginGroup("Cache");
+  if (settings_->contains("FaceCacheSize")) {
+    face_cache_size_ = settings_->value("FaceCacheSize").toUInt();
+  }
+  if (settings_->contains("SubsetCacheSize")) {
+    subset_cache_size_ = settings_->value("SubsetCacheSize").toUInt();
+  }
   settings_->endGroup();
 }
 
@@ -934,6 +988,15 @@ void MainWindow::SaveSettings() {
   settings_->setValue("MultiThread", mt_action_->isChecked());
 
   settings_->setValue("CombinedFonts", combined_action_->isChecked());
+  settings_->setValue("CombinedEmbed", combined_embed_action_->isChecked());
+  settings_->setValue("NoSubfontFiles", no_subfont_files_action_->isChecked());
+  settings_->setValue("NoIntermediateFiles",
+                      no_intermediate_files_action_->isChecked());
+  settings_->endGroup();
+
+  settings_->beginGroup("Cache");
+  settings_->setValue("FaceCacheSize", face_cache_size_);
+  settings_->setValue("SubsetCacheSize", subset_cache_size_);
   settings_->endGroup();
 }
 
@@ -958,6 +1021,9 @@ void MainWindow::OnResetActionTrigger() {
 
   mt_action_->setChecked(false);
   combined_action_->setChecked(false);
+  combined_embed_action_->setChecked(false);
+  no_subfont_files_action_->setChecked(false);
+  no_intermediate_files_action_->setChecked(false);
 
   log_buffer_.clear();
   QString version_info = "assfonts -- version " +
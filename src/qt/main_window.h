@@ -29,6 +29,8 @@
 #include <QTextEdit>
 #include <QThread>
 
+#include <assfonts.h>
+
 #include "check_window.h"
 #include "checkable_button.h"
 #include "drop_lineedit.h"
@@ -66,7 +68,10 @@ class MainWindow : public QMainWindow {
   void OnSendStart(QString inputs_path, QString output_path, QString fonts_path,
                    QString db_path, unsigned int brightness,
                    bool is_subset_only, bool is_embed_only, bool is_rename,
-                   bool is_font_combined, unsigned int num_thread);
+                   bool is_font_combined, bool is_combined_embed,
+                   bool is_no_subfont_files, bool is_no_intermediate_files,
+                   unsigned int face_cache_size, unsigned int subset_cache_size,
+                   unsigned int num_thread);
 
  private:
   struct LogItem {
@@ -90,6 +95,9 @@ class MainWindow : public QMainWindow {
   QAction* mt_action_;
 
   QAction* combined_action_;
+  QAction* combined_embed_action_;
+  QAction* no_subfont_files_action_;
+  QAction* no_intermediate_files_action_;
 
   QLabel* input_label_;
   QLabel* output_label_;
@@ -125,6 +133,10 @@ class MainWindow : public QMainWindow {
 
   QSettings* settings_;
 
+  // Cache budgets in MiB, only set in the settings file
+  unsigned int face_cache_size_ = ASSFONTS_DEFAULT_FACE_CACHE_SIZE;
+  unsigned int subset_cache_size_ = ASSFONTS_DEFAULT_SUBSET_CACHE_SIZE;
+
   void InitMenu();
   void InitMainWindowLayout();
 
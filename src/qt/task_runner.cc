@@ -63,6 +63,11 @@ void TaskRunner::OnStartRun(const QString inputs_path,
                             const unsigned int brightness,
                             const bool is_subset_only, const bool is_embed_only,
                             const bool is_rename, const bool is_font_combined,
+                            const bool is_combined_embed,
+                            const bool is_no_subfont_files,
+                            const bool is_no_intermediate_files,
+                            const unsigned int face_cache_size,
+                            const unsigned int subset_cache_size,
                             const unsigned int num_thread) {
   is_running_ = true;
 
@@ -98,7 +103,9 @@ void TaskRunner::OnStartRun(const QString inputs_path,
               const_cast<const char**>(fonts_char_list.get()),
               fonts_list.size(), db_path.toUtf8().constData(), brightness,
               is_subset_only, is_embed_only, is_rename, is_font_combined,
-              num_thread, log_callback, ASSFONTS_INFO);
+              is_combined_embed, is_no_subfont_files, is_no_intermediate_files,
+              face_cache_size, subset_cache_size, num_thread, log_callback,
+              ASSFONTS_INFO);
 
   log_callback("", ASSFONTS_TEXT);
 
@@ -45,7 +45,12 @@ class TaskRunner : public QObject {
                   const QString fonts_path, const QString db_path,
                   const unsigned int brightness, const bool is_subset_only,
                   const bool is_embed_only, const bool is_rename,
-                  const bool is_font_combined, const unsigned int num_thread);
+                  const bool is_font_combined, const bool is_combined_embed,
+                  const bool is_no_subfont_files,
+                  const bool is_no_intermediate_files,
+                  const unsigned int face_cache_size,
+                  const unsigned int subset_cache_size,
+                  const unsigned int num_thread);
 
  signals:
   void OnSendLog(QString msg, ASSFONTS_LOG_LEVEL log_level);